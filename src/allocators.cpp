@@ -0,0 +1,253 @@
+#include "allocators.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "profiler.h"
+#include "ufbx.h"
+
+namespace {
+
+constexpr size_t ArenaGranularity = (size_t)64 << 10;
+constexpr size_t PoolMinBlock = 16;
+constexpr int MaxAllocationReports = 32;
+
+// ufbx makes allocations above UfbxHugeThreshold one by one, the rest share
+// chunks of up to PoolMaxBlock, so all but the largest arrays come from the pool.
+constexpr size_t UfbxHugeThreshold = PoolMaxBlock / 16;
+
+size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void* allocate_block(size_t size) {
+  return ::operator new(size, std::align_val_t(FrameArenaAlignment));
+}
+
+void free_block(void* memory) {
+  ::operator delete(memory, std::align_val_t(FrameArenaAlignment));
+}
+
+// Smallest class whose blocks hold size bytes.
+int size_class(size_t size) {
+  int index = 0;
+  for (size_t block = PoolMinBlock; block < size; block <<= 1) {
+    index++;
+  }
+  return index;
+}
+
+size_t class_size(int index) {
+  return PoolMinBlock << index;
+}
+
+void* ufbx_pool_alloc(void* user, size_t size) {
+  return ((PoolAllocator*)user)->Allocate(size);
+}
+
+void* ufbx_pool_realloc(void* user, void* memory, size_t old_size, size_t new_size) {
+  return ((PoolAllocator*)user)->Reallocate(memory, old_size, new_size);
+}
+
+void ufbx_pool_free(void* user, void* memory, size_t size) {
+  ((PoolAllocator*)user)->Free(memory, size);
+}
+
+} // namespace
+
+FrameArena::FrameArena(size_t capacity) : capacity(align_up(capacity, FrameArenaAlignment)) {
+  if (this->capacity > 0) {
+    block = (uint8_t*)allocate_block(this->capacity);
+  }
+}
+
+FrameArena::~FrameArena() {
+  Reset();
+  if (block) {
+    free_block(block);
+  }
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment) {
+  size = std::max<size_t>(size, 1);
+  size_t current = offset.load(std::memory_order_relaxed);
+  for (;;) {
+    size_t begin = align_up(current, alignment);
+    if (begin + size > capacity) {
+      return AllocateOverflow(size, alignment);
+    }
+    if (offset.compare_exchange_weak(current, begin + size, std::memory_order_relaxed)) {
+      return block + begin;
+    }
+  }
+}
+
+void* FrameArena::AllocateOverflow(size_t size, size_t alignment) {
+  std::lock_guard<std::mutex> lock(overflow_mutex);
+  void* memory = allocate_block(size);
+  overflow_blocks.push_back(memory);
+  overflow_bytes += align_up(size, alignment);
+  overflows++;
+  return memory;
+}
+
+void FrameArena::Reset() {
+  size_t used = Used();
+  peak = std::max(peak, used);
+
+  for (void* memory : overflow_blocks) {
+    free_block(memory);
+  }
+  overflow_blocks.clear();
+
+  // Sized for the whole of this frame with some room, so the next one fits in the block.
+  if (overflow_bytes > 0) {
+    if (block) {
+      free_block(block);
+    }
+    capacity = align_up(used + used / 4, ArenaGranularity);
+    block = (uint8_t*)allocate_block(capacity);
+  }
+  overflow_bytes = 0;
+  offset.store(0, std::memory_order_relaxed);
+}
+
+PoolAllocator::PoolAllocator(size_t chunk_size) : chunk_size(std::max(chunk_size, PoolMaxBlock)) {}
+
+PoolAllocator::~PoolAllocator() {
+  for (void* chunk : chunks) {
+    free(chunk);
+  }
+}
+
+void* PoolAllocator::Allocate(size_t size) {
+  if (size > PoolMaxBlock) {
+    void* memory = malloc(size);
+    if (memory) {
+      std::lock_guard<std::mutex> lock(mutex);
+      stats.large_bytes += size;
+      stats.allocations++;
+    }
+    return memory;
+  }
+
+  int index = size_class(size);
+  size_t block_size = class_size(index);
+  std::lock_guard<std::mutex> lock(mutex);
+
+  void* memory = nullptr;
+  if (FreeBlock* block = free_lists[index]) {
+    free_lists[index] = block->next;
+    memory = block;
+    stats.reused++;
+  } else {
+    if (chunk_left < block_size) {
+      // The tail of the old chunk goes to the classes it still fits, largest first.
+      while (chunk_left >= PoolMinBlock) {
+        int tail = size_class(chunk_left + 1) - 1;
+        FreeBlock* block = (FreeBlock*)chunk_cursor;
+        block->next = free_lists[tail];
+        free_lists[tail] = block;
+        chunk_cursor += class_size(tail);
+        chunk_left -= class_size(tail);
+      }
+
+      void* chunk = malloc(chunk_size);
+      if (!chunk) {
+        return nullptr;
+      }
+      chunks.push_back(chunk);
+      chunk_cursor = (uint8_t*)chunk;
+      chunk_left = chunk_size;
+      stats.reserved_bytes += chunk_size;
+    }
+    memory = chunk_cursor;
+    chunk_cursor += block_size;
+    chunk_left -= block_size;
+  }
+
+  stats.allocations++;
+  stats.used_bytes += block_size;
+  stats.peak_used_bytes = std::max(stats.peak_used_bytes, stats.used_bytes);
+  return memory;
+}
+
+void* PoolAllocator::Reallocate(void* memory, size_t old_size, size_t new_size) {
+  if (!memory) {
+    return Allocate(new_size);
+  }
+  if (new_size == 0) {
+    Free(memory, old_size);
+    return nullptr;
+  }
+  if (old_size <= PoolMaxBlock && new_size <= PoolMaxBlock && size_class(old_size) == size_class(new_size)) {
+    return memory;
+  }
+
+  void* resized = Allocate(new_size);
+  if (resized) {
+    memcpy(resized, memory, std::min(old_size, new_size));
+    Free(memory, old_size);
+  }
+  return resized;
+}
+
+void PoolAllocator::Free(void* memory, size_t size) {
+  if (!memory) {
+    return;
+  }
+  if (size > PoolMaxBlock) {
+    free(memory);
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.large_bytes -= size;
+    return;
+  }
+
+  int index = size_class(size);
+  std::lock_guard<std::mutex> lock(mutex);
+  FreeBlock* block = (FreeBlock*)memory;
+  block->next = free_lists[index];
+  free_lists[index] = block;
+  stats.used_bytes -= class_size(index);
+}
+
+PoolStats PoolAllocator::Stats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+PoolAllocator& asset_pool() {
+  static PoolAllocator pool;
+  return pool;
+}
+
+void set_ufbx_allocator(ufbx_allocator_opts& opts, PoolAllocator& pool) {
+  opts.allocator.alloc_fn = ufbx_pool_alloc;
+  opts.allocator.realloc_fn = ufbx_pool_realloc;
+  opts.allocator.free_fn = ufbx_pool_free;
+  opts.allocator.free_allocator_fn = nullptr;
+  opts.allocator.user = &pool;
+  opts.huge_threshold = UfbxHugeThreshold;
+  opts.max_chunk_size = PoolMaxBlock;
+}
+
+void report_frame_allocations(const char* loop, uint64_t frame) {
+#if defined(BONES_ALLOC_CHECK) && defined(BONES_PROFILER)
+  static int reports = 0;
+  uint64_t allocations = profiler_frame_counters()[ProfileCounter::Allocations];
+  if (allocations == 0 || reports > MaxAllocationReports) {
+    return;
+  }
+  if (++reports > MaxAllocationReports) {
+    fprintf(stderr, "%s: more frames allocated, no further reports\n", loop);
+    return;
+  }
+  fprintf(stderr, "%s: frame %llu made %llu heap allocations\n", loop, (unsigned long long)frame, (unsigned long long)allocations);
+#else
+  (void)loop;
+  (void)frame;
+#endif
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct ufbx_allocator_opts;
+
+// Scratch memory for one frame. Allocations bump an offset into one block and
+// Reset() at the end of the frame takes them all back at once. Allocate() may be
+// called from any thread. What does not fit goes to the heap, and the next Reset()
+// grows the block to the frame's peak, so once a workload has run a frame or two
+// it never touches the heap again.
+class FrameArena {
+public:
+  explicit FrameArena(size_t capacity = 0);
+  ~FrameArena();
+
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  // Never null, alignment is a power of two up to FrameArenaAlignment.
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  // Uninitialized, valid until the next Reset().
+  template <typename T>
+  T* Allocate(size_t count) {
+    return (T*)Allocate(count * sizeof(T), alignof(T));
+  }
+
+  // Frees everything allocated since the last Reset(), no Allocate() may run concurrently.
+  void Reset();
+
+  size_t Capacity() const { return capacity; }
+  size_t Used() const { return offset.load(std::memory_order_relaxed) + overflow_bytes; }
+  size_t Peak() const { return peak; }
+  uint64_t Overflows() const { return overflows; } // allocations that had to go to the heap
+
+private:
+  void* AllocateOverflow(size_t size, size_t alignment);
+
+  uint8_t* block = nullptr;
+  size_t capacity = 0;
+  std::atomic<size_t> offset{0};
+
+  std::mutex overflow_mutex;
+  std::vector<void*> overflow_blocks;
+  size_t overflow_bytes = 0;
+  size_t peak = 0;
+  uint64_t overflows = 0;
+};
+
+constexpr size_t FrameArenaAlignment = 64;
+
+struct PoolStats {
+  size_t reserved_bytes = 0; // chunks taken from the heap for the size classes
+  size_t used_bytes = 0;     // blocks handed out, rounded up to their class
+  size_t peak_used_bytes = 0;
+  size_t large_bytes = 0;    // allocations above the largest class, straight from the heap
+  uint64_t allocations = 0;
+  uint64_t reused = 0;       // allocations served from a free list
+};
+
+// General purpose allocator for long-lived asset data and for ufbx while it parses
+// a scene. Blocks up to PoolMaxBlock bytes come from power of two size classes
+// carved out of large chunks, freed blocks go back to their class for the next
+// load and chunks are only returned when the pool goes away. Larger blocks go
+// straight to the heap. Thread-safe, frees must pass the size that was allocated.
+class PoolAllocator {
+public:
+  explicit PoolAllocator(size_t chunk_size = (size_t)4 << 20);
+  ~PoolAllocator();
+
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+  // 16 byte aligned, null only when the heap is out of memory.
+  void* Allocate(size_t size);
+  void* Reallocate(void* memory, size_t old_size, size_t new_size);
+  void Free(void* memory, size_t size);
+
+  PoolStats Stats() const;
+
+private:
+  static constexpr int NumClasses = 17; // 16 bytes to 1 MB
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  mutable std::mutex mutex;
+  size_t chunk_size;
+  std::vector<void*> chunks;
+  uint8_t* chunk_cursor = nullptr;
+  size_t chunk_left = 0;
+  FreeBlock* free_lists[NumClasses] = {};
+  PoolStats stats;
+};
+
+constexpr size_t PoolMaxBlock = (size_t)1 << 20;
+
+// The pool asset loading parses into, shared by every loader thread.
+PoolAllocator& asset_pool();
+
+// Points the temp or result allocator of a ufbx call at pool. ufbx batches small
+// allocations into chunks that then fit the size classes, and pool must outlive
+// whatever the call returns.
+void set_ufbx_allocator(ufbx_allocator_opts& opts, PoolAllocator& pool);
+
+// Debug mode for allocation-free frame loops. Built with BONES_ALLOC_CHECK (which
+// needs BONES_PROFILER and its counting operator new), prints how many heap
+// allocations the frame profiler_frame() just ended made, when there were any.
+// Reports stop after the first few dozen. Otherwise it does nothing.
+void report_frame_allocations(const char* loop, uint64_t frame);
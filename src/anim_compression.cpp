@@ -0,0 +1,401 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "simd.h"
+#include "skeleton.h"
+
+namespace {
+
+constexpr float SmallestThreeRange = 0.70710678f; // the three smaller components stay within +-1/sqrt(2)
+constexpr float RotationScale = 32767.0f;
+constexpr float VectorScale = 65535.0f;
+constexpr uint32_t MaxFrames = UINT16_MAX + 1;
+
+// Most frames one pair of keys may interpolate over, bounds the frames checked per key.
+constexpr uint32_t MaxKeySpan = 256;
+
+enum Channel {
+  Translation,
+  Rotation,
+  Scale,
+};
+
+// Where channel c of joint j starts in a BakedClip frame.
+size_t channel_offset(int c, size_t num_joints, size_t j) {
+  switch (c) {
+    case Translation: return j * 3;
+    case Rotation: return num_joints * 3 + j * 4;
+    default: return num_joints * 7 + j * 3;
+  }
+}
+
+const float* channel_range(const std::vector<float>& ranges, int c, size_t j) {
+  return ranges.data() + j * 12 + (c == Scale ? 6 : 0);
+}
+
+void encode_rotation(const float* q, uint16_t* out) {
+  int largest = 0;
+  for (int i = 1; i < 4; i++) {
+    if (std::fabs(q[i]) > std::fabs(q[largest])) {
+      largest = i;
+    }
+  }
+
+  // q and -q are the same rotation, flip so the dropped component is positive.
+  float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+  int k = 0;
+  for (int i = 0; i < 4; i++) {
+    if (i == largest) {
+      continue;
+    }
+    float v = std::clamp(q[i] * sign / SmallestThreeRange * 0.5f + 0.5f, 0.0f, 1.0f);
+    uint16_t bits = (uint16_t)std::lrint(v * RotationScale);
+    out[k] = (uint16_t)((bits << 1) | ((largest >> k) & 1));
+    k++;
+  }
+}
+
+void decode_rotation(const uint16_t* in, float* q) {
+  int largest = (in[0] & 1) | ((in[1] & 1) << 1);
+  float sum = 0.0f;
+  int k = 0;
+  for (int i = 0; i < 4; i++) {
+    if (i == largest) {
+      continue;
+    }
+    float v = ((float)(in[k] >> 1) / RotationScale * 2.0f - 1.0f) * SmallestThreeRange;
+    q[i] = v;
+    sum += v * v;
+    k++;
+  }
+  q[largest] = std::sqrt(std::max(1.0f - sum, 0.0f));
+}
+
+// range is min xyz then extent xyz.
+void encode_vector(const float* v, const float* range, uint16_t* out) {
+  for (int i = 0; i < 3; i++) {
+    float x = range[3 + i] > 0.0f ? (v[i] - range[i]) / range[3 + i] : 0.0f;
+    out[i] = (uint16_t)std::lrint(std::clamp(x, 0.0f, 1.0f) * VectorScale);
+  }
+}
+
+void decode_vector(const uint16_t* in, const float* range, float* v) {
+  for (int i = 0; i < 3; i++) {
+    v[i] = range[i] + range[3 + i] * ((float)in[i] * (1.0f / VectorScale));
+  }
+}
+
+void decode_key(int c, const uint16_t* in, const float* range, float* out) {
+  if (c == Rotation) {
+    decode_rotation(in, out);
+  } else {
+    decode_vector(in, range, out);
+  }
+}
+
+// Lerp for vectors, nlerp through the shorter arc for rotations.
+void blend_channel(int c, const float* a, const float* b, float t, float* out) {
+  if (c != Rotation) {
+    for (int i = 0; i < 3; i++) {
+      out[i] = a[i] + (b[i] - a[i]) * t;
+    }
+    return;
+  }
+
+  float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  float tb = dot < 0.0f ? -t : t;
+  float length = 0.0f;
+  for (int i = 0; i < 4; i++) {
+    out[i] = a[i] * (1.0f - t) + b[i] * tb;
+    length += out[i] * out[i];
+  }
+  float inv = length > 0.0f ? 1.0f / std::sqrt(length) : 0.0f;
+  for (int i = 0; i < 4; i++) {
+    out[i] *= inv;
+  }
+}
+
+// Model-space matrices of joints [begin, end) of one frame. Parents outside the
+// range must already be in model, which holds the skeleton subtrees contiguously.
+void compose_frame(const Skeleton& skeleton, const float* frame, size_t begin, size_t end, float* model) {
+  size_t n = skeleton.NumJoints();
+  for (size_t j = begin; j < end; j++) {
+    const float* t = frame + channel_offset(Translation, n, j);
+    const float* r = frame + channel_offset(Rotation, n, j);
+    const float* s = frame + channel_offset(Scale, n, j);
+    int32_t parent = skeleton.parents[j];
+    if (parent < 0) {
+      mat4_from_trs(t, r, s, model + j * 16);
+      continue;
+    }
+
+    float local[16];
+    mat4_from_trs(t, r, s, local);
+    mat4_mul(model + (size_t)parent * 16, local, model + j * 16);
+  }
+}
+
+// Furthest distance between the joint origins and their shell points.
+float joint_error(const float* a, const float* b, float shell) {
+  float d[3] = { a[12] - b[12], a[13] - b[13], a[14] - b[14] };
+  float error = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+  for (int axis = 0; axis < 3; axis++) {
+    float length = 0.0f;
+    for (int i = 0; i < 3; i++) {
+      float e = d[i] + shell * (a[axis * 4 + i] - b[axis * 4 + i]);
+      length += e * e;
+    }
+    error = std::max(error, length);
+  }
+  return std::sqrt(error);
+}
+
+float subtree_error(const float* model, const float* reference, size_t begin, size_t end, float shell) {
+  float error = 0.0f;
+  for (size_t j = begin; j < end; j++) {
+    error = std::max(error, joint_error(model + j * 16, reference + j * 16, shell));
+  }
+  return error;
+}
+
+// True when every joint of [begin, end) stays within its bound.
+bool subtree_within(const float* model, const float* reference, const float* bounds, size_t begin, size_t end, float shell) {
+  for (size_t j = begin; j < end; j++) {
+    if (joint_error(model + j * 16, reference + j * 16, shell) > bounds[j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+size_t AnimClip::SizeBytes() const {
+  return tracks.size() * sizeof(AnimTrack) + key_frames.size() * sizeof(uint16_t) +
+         key_values.size() * sizeof(uint16_t) + ranges.size() * sizeof(float);
+}
+
+bool compress_clip(const BakedClip& clip, const Skeleton& skeleton, const AnimCompressionOptions& options, AnimClip& out) {
+  const size_t n = clip.num_joints;
+  const uint32_t num_frames = clip.num_frames;
+  if (n != skeleton.NumJoints()) {
+    fprintf(stderr, "Clip %s has %zu joints, the skeleton %zu\n", clip.name.c_str(), n, skeleton.NumJoints());
+    return false;
+  }
+  if (num_frames == 0 || num_frames > MaxFrames) {
+    fprintf(stderr, "Clip %s has %u frames, at most %u can be compressed\n", clip.name.c_str(), num_frames, MaxFrames);
+    return false;
+  }
+
+  out = AnimClip();
+  out.name = clip.name;
+  out.duration = clip.duration;
+  out.sample_rate = clip.sample_rate;
+  out.num_frames = num_frames;
+  out.num_joints = (uint32_t)n;
+  out.tracks.resize(n * 3);
+  out.ranges.assign(n * 12, 0.0f);
+
+  // Every key quantized, and current holds what the sampler would decode at each
+  // frame. Key reduction replaces removed keys in current by their interpolation.
+  const size_t stride = clip.FrameStride();
+  std::vector<uint16_t> encoded((size_t)num_frames * n * 9);
+  std::vector<float> current(clip.frames.size());
+  std::vector<uint8_t> constant(n * 3);
+
+  for (size_t j = 0; j < n; j++) {
+    for (int c = 0; c < 3; c++) {
+      size_t offset = channel_offset(c, n, j);
+      float* range = out.ranges.data() + j * 12 + (c == Scale ? 6 : 0);
+      if (c != Rotation) {
+        for (int i = 0; i < 3; i++) {
+          float lo = clip.frames[offset + i];
+          float hi = lo;
+          for (uint32_t f = 1; f < num_frames; f++) {
+            lo = std::min(lo, clip.frames[f * stride + offset + i]);
+            hi = std::max(hi, clip.frames[f * stride + offset + i]);
+          }
+          range[i] = lo;
+          range[3 + i] = hi - lo;
+        }
+      }
+
+      bool same = true;
+      for (uint32_t f = 0; f < num_frames; f++) {
+        uint16_t* key = encoded.data() + ((f * n + j) * 3 + c) * 3;
+        if (c == Rotation) {
+          encode_rotation(clip.frames.data() + f * stride + offset, key);
+        } else {
+          encode_vector(clip.frames.data() + f * stride + offset, range, key);
+        }
+        decode_key(c, key, range, current.data() + f * stride + offset);
+        same = same && memcmp(key, encoded.data() + ((size_t)j * 3 + c) * 3, 3 * sizeof(uint16_t)) == 0;
+      }
+      constant[j * 3 + c] = same;
+    }
+  }
+
+  std::vector<float> reference((size_t)num_frames * n * 16);
+  std::vector<float> model((size_t)num_frames * n * 16);
+  for (uint32_t f = 0; f < num_frames; f++) {
+    compose_frame(skeleton, clip.FrameData(f), 0, n, reference.data() + f * n * 16);
+    compose_frame(skeleton, current.data() + f * stride, 0, n, model.data() + f * n * 16);
+  }
+
+  // Deep chains of long bones can be off by more than max_error from quantization
+  // alone, such joints may not get worse than that but are not held to the bound.
+  std::vector<float> bounds((size_t)num_frames * n);
+  for (uint32_t f = 0; f < num_frames; f++) {
+    for (size_t j = 0; j < n; j++) {
+      size_t m = (f * n + j) * 16;
+      bounds[f * n + j] = std::max(options.max_error, joint_error(model.data() + m, reference.data() + m, options.shell_distance));
+    }
+  }
+
+  // Joints are depth first, so the subtree of j is [j, subtree_end[j]).
+  std::vector<size_t> subtree_end(n);
+  for (size_t j = n; j-- > 0;) {
+    subtree_end[j] = std::max(subtree_end[j], j + 1);
+    if (skeleton.parents[j] >= 0) {
+      size_t parent = (size_t)skeleton.parents[j];
+      subtree_end[parent] = std::max(subtree_end[parent], subtree_end[j]);
+    }
+  }
+
+  // Per track, parents first: from each kept key the next one goes as far ahead
+  // as interpolating between them keeps the whole subtree within bounds on every
+  // frame between. The span doubles until it fails and is then bisected, so each
+  // key checks O(span log span) frames rather than rechecking a growing span per
+  // frame. Spans are tried in current itself and composed into scratch_model,
+  // which only needs the parent's matrix and the subtree.
+  std::vector<uint8_t> kept(num_frames);
+  std::vector<float> scratch_model(n * 16);
+  for (size_t j = 0; j < n; j++) {
+    size_t end = subtree_end[j];
+    int32_t parent = skeleton.parents[j];
+    for (int c = 0; c < 3; c++) {
+      AnimTrack& track = out.tracks[j * 3 + c];
+      track.first_key = (uint32_t)out.key_frames.size();
+      size_t offset = channel_offset(c, n, j);
+      size_t width = c == Rotation ? 4 : 3;
+
+      auto span_within = [&](uint32_t a, uint32_t b) {
+        const float* key_a = current.data() + a * stride + offset;
+        const float* key_b = current.data() + b * stride + offset;
+        bool ok = true;
+        for (uint32_t f = a + 1; ok && f < b; f++) {
+          float* channel = current.data() + f * stride + offset;
+          float saved[4];
+          memcpy(saved, channel, width * sizeof(float));
+          blend_channel(c, key_a, key_b, (float)(f - a) / (float)(b - a), channel);
+          if (parent >= 0) {
+            memcpy(scratch_model.data() + (size_t)parent * 16, model.data() + (f * n + parent) * 16, 16 * sizeof(float));
+          }
+          compose_frame(skeleton, current.data() + f * stride, j, end, scratch_model.data());
+          memcpy(channel, saved, width * sizeof(float));
+          ok = subtree_within(scratch_model.data(), reference.data() + f * n * 16, bounds.data() + f * n, j, end, options.shell_distance);
+        }
+        return ok;
+      };
+
+      std::fill(kept.begin(), kept.end(), 1);
+      if (constant[j * 3 + c]) {
+        std::fill(kept.begin() + 1, kept.end(), 0);
+      }
+
+      for (uint32_t a = 0; !constant[j * 3 + c] && a + 1 < num_frames;) {
+        uint32_t last = std::min(a + MaxKeySpan, num_frames - 1);
+        uint32_t good = a + 1;
+        uint32_t bad = last + 1;
+        for (uint32_t span = 2; a + span <= last; span *= 2) {
+          if (!span_within(a, a + span)) {
+            bad = a + span;
+            break;
+          }
+          good = a + span;
+        }
+        if (bad > last && good < last) {
+          if (span_within(a, last)) {
+            good = last;
+          } else {
+            bad = last;
+          }
+        }
+        while (bad - good > 1) {
+          uint32_t mid = good + (bad - good) / 2;
+          if (span_within(a, mid)) {
+            good = mid;
+          } else {
+            bad = mid;
+          }
+        }
+
+        uint32_t b = good;
+        const float* key_a = current.data() + a * stride + offset;
+        const float* key_b = current.data() + b * stride + offset;
+        for (uint32_t f = a + 1; f < b; f++) {
+          kept[f] = 0;
+          float value[4];
+          blend_channel(c, key_a, key_b, (float)(f - a) / (float)(b - a), value);
+          memcpy(current.data() + f * stride + offset, value, width * sizeof(float));
+          compose_frame(skeleton, current.data() + f * stride, j, end, model.data() + f * n * 16);
+        }
+        a = b;
+      }
+
+      for (uint32_t f = 0; f < num_frames; f++) {
+        if (kept[f]) {
+          const uint16_t* key = encoded.data() + ((f * n + j) * 3 + c) * 3;
+          out.key_frames.push_back((uint16_t)f);
+          out.key_values.insert(out.key_values.end(), key, key + 3);
+        }
+      }
+      track.num_keys = (uint32_t)out.key_frames.size() - track.first_key;
+    }
+  }
+
+  for (uint32_t f = 0; f < num_frames; f++) {
+    out.max_error = std::max(out.max_error, subtree_error(model.data() + f * n * 16, reference.data() + f * n * 16, 0, n, options.shell_distance));
+  }
+  return true;
+}
+
+void sample_clip(const AnimClip& clip, float time, bool loop, Pose& pose) {
+  if (clip.num_frames == 0) {
+    return;
+  }
+
+  if (pose.NumJoints() != clip.num_joints) {
+    pose.Resize(clip.num_joints);
+  }
+
+  float x = clip_frame_position(time, clip.duration, clip.num_frames, loop);
+  uint16_t frame = (uint16_t)x;
+  float* outputs[3] = { pose.translations.data(), pose.rotations.data(), pose.scales.data() };
+
+  const AnimTrack* track = clip.tracks.data();
+  for (size_t j = 0; j < clip.num_joints; j++) {
+    for (int c = 0; c < 3; c++, track++) {
+      const uint16_t* frames = clip.key_frames.data() + track->first_key;
+      const uint16_t* values = clip.key_values.data() + (size_t)track->first_key * 3;
+      const float* range = channel_range(clip.ranges, c, j);
+      float* out = outputs[c] + j * (c == Rotation ? 4 : 3);
+
+      // Last key at or before the frame, the first key is always frame 0.
+      uint32_t k = (uint32_t)(std::upper_bound(frames + 1, frames + track->num_keys, frame) - frames) - 1;
+      if (k + 1 >= track->num_keys) {
+        decode_key(c, values + k * 3, range, out);
+        continue;
+      }
+
+      float a[4], b[4];
+      decode_key(c, values + k * 3, range, a);
+      decode_key(c, values + (k + 1) * 3, range, b);
+      blend_channel(c, a, b, (x - (float)frames[k]) / (float)(frames[k + 1] - frames[k]), out);
+    }
+  }
+}
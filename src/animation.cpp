@@ -0,0 +1,210 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "allocators.h"
+#include "skeleton.h"
+
+void Pose::Resize(size_t num_joints) {
+  translations.resize(num_joints * 3);
+  rotations.resize(num_joints * 4);
+  scales.resize(num_joints * 3);
+}
+
+// Walks the baked keys once with a forward cursor, calling write(frame, a, b, t)
+// for every output frame, the frames spread evenly over [0, duration]. No per-frame
+// search since frame times only increase.
+template <typename Key, typename Write>
+static void resample_track(const Key* keys, size_t count, uint32_t num_frames, double duration, Write write) {
+  if (count == 0) {
+    return;
+  }
+
+  size_t cursor = 0;
+  for (uint32_t f = 0; f < num_frames; f++) {
+    double time = num_frames > 1 ? duration * f / (num_frames - 1) : 0.0;
+    while (cursor + 1 < count && keys[cursor + 1].time <= time) {
+      cursor++;
+    }
+
+    const Key& a = keys[cursor];
+    if (cursor + 1 >= count || time <= a.time) {
+      write(f, a.value, a.value, 0.0);
+      continue;
+    }
+
+    const Key& b = keys[cursor + 1];
+    write(f, a.value, b.value, (time - a.time) / (b.time - a.time));
+  }
+}
+
+static bool bake_clip(const ufbx_scene* scene, const Skeleton& skeleton, const ufbx_anim_stack* stack, float sample_rate, BakedClip& clip) {
+  ufbx_bake_opts opts = {0};
+  opts.resample_rate = sample_rate;
+  opts.trim_start_time = true;
+  set_ufbx_allocator(opts.temp_allocator, asset_pool());
+  set_ufbx_allocator(opts.result_allocator, asset_pool());
+
+  ufbx_error error;
+  ufbx_baked_anim* baked = ufbx_bake_anim(scene, stack->anim, &opts, &error);
+  if (!baked) {
+    fprintf(stderr, "Failed to bake %s: %s\n", stack->name.data, error.description.data);
+    return false;
+  }
+
+  // trim_start_time moves the keys to start at 0 but leaves playback_time_begin
+  // as it was, so frames are sampled from 0.
+  double duration = baked->playback_duration;
+  if (duration <= 0.0) {
+    duration = std::max(baked->key_time_max, 0.0);
+  }
+
+  // At least sample_rate frames per second, spaced evenly so the last one lands on duration.
+  uint32_t num_joints = (uint32_t)skeleton.NumJoints();
+  uint32_t num_frames = (uint32_t)std::ceil(duration * sample_rate - 1e-6) + 1;
+
+  clip.name.assign(stack->name.data, stack->name.length);
+  clip.duration = (float)duration;
+  clip.sample_rate = sample_rate;
+  clip.num_frames = num_frames;
+  clip.num_joints = num_joints;
+  clip.frames.resize((size_t)num_frames * clip.FrameStride());
+
+  const size_t stride = clip.FrameStride();
+  const size_t rotation_offset = (size_t)num_joints * 3;
+  const size_t scale_offset = (size_t)num_joints * 7;
+
+  // Joints the animation does not touch keep their rest transform.
+  const Pose& rest = skeleton.rest;
+  for (uint32_t f = 0; f < num_frames; f++) {
+    float* frame = clip.frames.data() + f * stride;
+    memcpy(frame, rest.translations.data(), num_joints * 3 * sizeof(float));
+    memcpy(frame + rotation_offset, rest.rotations.data(), num_joints * 4 * sizeof(float));
+    memcpy(frame + scale_offset, rest.scales.data(), num_joints * 3 * sizeof(float));
+  }
+
+  for (const ufbx_baked_node& node : baked->nodes) {
+    if (node.typed_id >= skeleton.node_joints.size()) {
+      continue;
+    }
+    uint32_t n = skeleton.node_joints[node.typed_id];
+
+    auto write_vec3 = [&](size_t offset) {
+      return [&, offset](uint32_t f, ufbx_vec3 a, ufbx_vec3 b, double t) {
+        float* out = clip.frames.data() + f * stride + offset + n * 3;
+        for (int i = 0; i < 3; i++) {
+          out[i] = (float)(a.v[i] + (b.v[i] - a.v[i]) * t);
+        }
+      };
+    };
+
+    resample_track(node.translation_keys.data, node.translation_keys.count, num_frames, duration,
+                   write_vec3(0));
+    resample_track(node.scale_keys.data, node.scale_keys.count, num_frames, duration,
+                   write_vec3(scale_offset));
+    resample_track(node.rotation_keys.data, node.rotation_keys.count, num_frames, duration,
+                   [&](uint32_t f, ufbx_quat a, ufbx_quat b, double t) {
+      ufbx_quat q = ufbx_quat_slerp(a, b, t);
+      float* out = clip.frames.data() + f * stride + rotation_offset + n * 4;
+      for (int i = 0; i < 4; i++) {
+        out[i] = (float)q.v[i];
+      }
+    });
+  }
+
+  for (uint32_t f = 1; f < num_frames; f++) {
+    const float* prev = clip.frames.data() + (f - 1) * stride + rotation_offset;
+    float* cur = clip.frames.data() + f * stride + rotation_offset;
+    for (uint32_t n = 0; n < num_joints; n++) {
+      float dot = prev[n * 4] * cur[n * 4] + prev[n * 4 + 1] * cur[n * 4 + 1] + prev[n * 4 + 2] * cur[n * 4 + 2] + prev[n * 4 + 3] * cur[n * 4 + 3];
+      if (dot < 0.0f) {
+        for (int i = 0; i < 4; i++) {
+          cur[n * 4 + i] = -cur[n * 4 + i];
+        }
+      }
+    }
+  }
+
+  ufbx_free_baked_anim(baked);
+  return true;
+}
+
+bool bake_anim_clips(const ufbx_scene* scene, const Skeleton& skeleton, float sample_rate, std::vector<BakedClip>& out_clips) {
+  out_clips.clear();
+  out_clips.reserve(scene->anim_stacks.count);
+
+  for (const ufbx_anim_stack* stack : scene->anim_stacks) {
+    BakedClip clip;
+    if (!bake_clip(scene, skeleton, stack, sample_rate, clip)) {
+      return false;
+    }
+    out_clips.push_back(std::move(clip));
+  }
+
+  return true;
+}
+
+float clip_frame_position(float time, float duration, uint32_t num_frames, bool loop) {
+  if (loop && duration > 0.0f) {
+    time = std::fmod(time, duration);
+    if (time < 0.0f) {
+      time += duration;
+    }
+  } else {
+    time = std::clamp(time, 0.0f, duration);
+  }
+  if (duration <= 0.0f || num_frames < 2) {
+    return 0.0f;
+  }
+  return std::min(time / duration * (float)(num_frames - 1), (float)(num_frames - 1));
+}
+
+void sample_clip(const BakedClip& clip, float time, bool loop, Pose& pose) {
+  if (clip.num_frames == 0) {
+    return;
+  }
+
+  if (pose.NumJoints() != clip.num_joints) {
+    pose.Resize(clip.num_joints);
+  }
+
+  float x = clip_frame_position(time, clip.duration, clip.num_frames, loop);
+  uint32_t last = clip.num_frames - 1;
+  uint32_t f0 = std::min((uint32_t)x, last);
+  uint32_t f1 = std::min(f0 + 1, last);
+  float t = std::clamp(x - (float)f0, 0.0f, 1.0f);
+
+  const size_t n = clip.num_joints;
+  const float* a = clip.FrameData(f0);
+  const float* b = clip.FrameData(f1);
+
+  float* translations = pose.translations.data();
+  for (size_t i = 0; i < n * 3; i++) {
+    translations[i] = a[i] + (b[i] - a[i]) * t;
+  }
+
+  a += n * 3;
+  b += n * 3;
+  float* rotations = pose.rotations.data();
+  for (size_t i = 0; i < n * 4; i++) {
+    rotations[i] = a[i] + (b[i] - a[i]) * t;
+  }
+  for (size_t i = 0; i < n; i++) {
+    float* q = rotations + i * 4;
+    float inv = 1.0f / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    q[0] *= inv;
+    q[1] *= inv;
+    q[2] *= inv;
+    q[3] *= inv;
+  }
+
+  a += n * 4;
+  b += n * 4;
+  float* scales = pose.scales.data();
+  for (size_t i = 0; i < n * 3; i++) {
+    scales[i] = a[i] + (b[i] - a[i]) * t;
+  }
+}
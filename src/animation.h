@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ufbx.h"
+
+class Skeleton;
+
+constexpr float DefaultAnimSampleRate = 30.0f;
+
+// Local TRS of every skeleton joint, SoA: xyz, xyzw, xyz per joint.
+struct Pose {
+  std::vector<float> translations;
+  std::vector<float> rotations;
+  std::vector<float> scales;
+
+  void Resize(size_t num_joints);
+  size_t NumJoints() const { return rotations.size() / 4; }
+};
+
+// One ufbx_anim_stack resampled at a fixed rate at full precision, the input to
+// compress_clip(). Every frame stores all joint tracks back to back (translations,
+// then rotations, then scales), so sampling a time touches two contiguous blocks.
+// Rotations are hemisphere-aligned with the previous frame at bake time so the
+// sampler can nlerp without a sign check.
+struct BakedClip {
+  std::string name;
+  float duration = 0.0f;
+  float sample_rate = DefaultAnimSampleRate;
+  uint32_t num_frames = 0;
+  uint32_t num_joints = 0;
+  std::vector<float> frames;
+
+  size_t FrameStride() const { return (size_t)num_joints * 10; }
+  const float* FrameData(uint32_t frame) const { return frames.data() + frame * FrameStride(); }
+  size_t SizeBytes() const { return frames.size() * sizeof(float); }
+};
+
+struct AnimCompressionOptions {
+  // Largest model-space distance any joint, or a point shell_distance away from
+  // it along each of its axes, may move from the baked clip. In scene units.
+  float max_error = 0.01f;
+  float shell_distance = 1.0f;
+};
+
+// Keys of one joint channel, first_key indexes key_frames and key_values.
+struct AnimTrack {
+  uint32_t first_key = 0;
+  uint32_t num_keys = 0;
+};
+
+// A BakedClip after compression, sampled without decompressing it first. Every
+// joint has a translation, rotation and scale track ([joint * 3 + channel]) of
+// the frames that survived key reduction, constant tracks keep a single key.
+// Key values are three uint16: rotations as smallest-three quaternions (15 bits
+// per component, the dropped index in the low bits of the first two) and
+// translations and scales quantized to the track's range.
+struct AnimClip {
+  std::string name;
+  float duration = 0.0f;
+  float sample_rate = DefaultAnimSampleRate;
+  uint32_t num_frames = 0;
+  uint32_t num_joints = 0;
+  float max_error = 0.0f; // measured when compressed
+
+  std::vector<AnimTrack> tracks;
+  std::vector<uint16_t> key_frames;
+  std::vector<uint16_t> key_values;
+  std::vector<float> ranges; // per joint: translation min, extent, then scale min, extent
+
+  size_t NumKeys() const { return key_frames.size(); }
+  size_t SizeBytes() const;
+};
+
+// Bakes every anim stack in the scene with ufbx_bake_anim() and resamples it into
+// clips in the joint order of skeleton.
+bool bake_anim_clips(const ufbx_scene* scene, const Skeleton& skeleton, float sample_rate, std::vector<BakedClip>& out_clips);
+
+// Quantizes clip and drops every key whose removal keeps the model-space error
+// under options.max_error, measured against the baked clip on skeleton. Joints
+// already further off from quantization alone keep that error as their bound.
+bool compress_clip(const BakedClip& clip, const Skeleton& skeleton, const AnimCompressionOptions& options, AnimClip& out);
+
+// Position of time in frames, wrapped or clamped to the clip. Frames are spread
+// evenly over [0, duration], the first at 0 and the last at duration.
+float clip_frame_position(float time, float duration, uint32_t num_frames, bool loop);
+
+// O(1) lookup: picks the two frames around time and blends them into pose.
+void sample_clip(const BakedClip& clip, float time, bool loop, Pose& pose);
+
+// Decodes the keys around time of every track straight into pose.
+void sample_clip(const AnimClip& clip, float time, bool loop, Pose& pose);
@@ -0,0 +1,801 @@
+#include "asset.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "allocators.h"
+#include "cache.h"
+#include "fbx_thread_pool.h"
+#include "profiler.h"
+#include "ufbx.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace {
+
+constexpr uint32_t TagModelInfo     = cache_tag('M', 'D', 'L', 'I');
+constexpr uint32_t TagMeshInfo      = cache_tag('M', 'S', 'H', 'I');
+constexpr uint32_t TagVertices      = cache_tag('V', 'E', 'R', 'T');
+constexpr uint32_t TagIndices       = cache_tag('I', 'N', 'D', 'X');
+constexpr uint32_t TagMeshBounds    = cache_tag('M', 'B', 'N', 'D');
+constexpr uint32_t TagJointParents  = cache_tag('J', 'P', 'A', 'R');
+constexpr uint32_t TagJointNodes    = cache_tag('J', 'N', 'O', 'D');
+constexpr uint32_t TagJointRestT    = cache_tag('J', 'R', 'S', 'T');
+constexpr uint32_t TagJointRestR    = cache_tag('J', 'R', 'S', 'R');
+constexpr uint32_t TagJointRestS    = cache_tag('J', 'R', 'S', 'S');
+constexpr uint32_t TagJointBind     = cache_tag('J', 'I', 'B', 'M');
+constexpr uint32_t TagSkinInfo      = cache_tag('S', 'K', 'N', 'I');
+constexpr uint32_t TagSkinIndices   = cache_tag('S', 'K', 'B', 'I');
+constexpr uint32_t TagSkinWeights   = cache_tag('S', 'K', 'B', 'W');
+constexpr uint32_t TagSkinPositions = cache_tag('S', 'K', 'B', 'P');
+constexpr uint32_t TagSkinNormals   = cache_tag('S', 'K', 'B', 'N');
+constexpr uint32_t TagSkinBones     = cache_tag('S', 'K', 'N', 'D');
+constexpr uint32_t TagSkinBind      = cache_tag('S', 'K', 'G', 'B');
+constexpr uint32_t TagSkinBounds    = cache_tag('S', 'K', 'B', 'X');
+constexpr uint32_t TagClipInfo      = cache_tag('C', 'L', 'P', 'I');
+constexpr uint32_t TagClipName      = cache_tag('C', 'L', 'P', 'N');
+constexpr uint32_t TagClipTracks    = cache_tag('C', 'L', 'P', 'T');
+constexpr uint32_t TagClipKeyFrames = cache_tag('C', 'L', 'K', 'F');
+constexpr uint32_t TagClipKeyValues = cache_tag('C', 'L', 'K', 'V');
+constexpr uint32_t TagClipRanges    = cache_tag('C', 'L', 'P', 'R');
+constexpr uint32_t TagTexturePath   = cache_tag('T', 'X', 'P', 'N');
+constexpr uint32_t TagTextureInfo   = cache_tag('T', 'E', 'X', 'I');
+constexpr uint32_t TagTextureMip    = cache_tag('T', 'E', 'X', 'M');
+
+struct ModelInfo {
+  uint32_t num_meshes;
+  uint32_t num_skins;
+  uint32_t num_clips;
+  uint32_t num_textures;
+};
+
+struct MeshInfo {
+  uint32_t index_size;
+  int32_t skin;
+  int32_t texture;
+  uint32_t reserved;
+};
+
+struct SkinInfo {
+  uint64_t num_vertices;
+  int32_t max_influences;
+  uint32_t num_bones;
+};
+
+struct ClipInfo {
+  float duration;
+  float sample_rate;
+  uint32_t num_frames;
+  uint32_t num_joints;
+  float max_error;
+  uint32_t reserved;
+};
+
+struct TextureInfo {
+  int32_t width;
+  int32_t height;
+  int32_t num_mips;
+  TextureFormat format;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Texture paths are stored relative to the model, so the cache moves with the assets.
+std::string directory_of(const char* path) {
+  const char* slash = strrchr(path, '/');
+  const char* backslash = strrchr(path, '\\');
+  const char* end = std::max(slash, backslash);
+  return end ? std::string(path, end + 1) : std::string();
+}
+
+bool is_absolute_path(const std::string& path) {
+  return !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+}
+
+template <typename T>
+bool copy_chunk(const CacheReader& reader, uint32_t tag, uint32_t index, std::vector<T>& out) {
+  size_t count = 0;
+  const T* data = reader.FindArray<T>(tag, index, &count);
+  if (!data) {
+    return false;
+  }
+  out.assign(data, data + count);
+  return true;
+}
+
+// Every index must name a vertex. Only checked in debug builds, a full pass over
+// the indices would cost release loads more than the rest of the validation.
+bool indices_in_range(const MeshView& view) {
+#ifndef NDEBUG
+  for (size_t i = 0; i < view.num_indices; i++) {
+    uint32_t index = view.index_size == 2 ? ((const uint16_t*)view.indices)[i] : ((const uint32_t*)view.indices)[i];
+    if (index >= view.num_vertices) {
+      return false;
+    }
+  }
+#else
+  (void)view;
+#endif
+  return true;
+}
+
+// Array sizes and indices the skinning paths and palette builders read unchecked.
+bool skin_consistent(const SkinData& skin, size_t num_joints) {
+  size_t n = skin.num_vertices;
+  size_t num_bones = skin.NumBones();
+  if ((skin.max_influences != 4 && skin.max_influences != 8) ||
+      skin.bone_indices.size() != n * (size_t)skin.max_influences ||
+      skin.bone_weights.size() != n * (size_t)skin.max_influences ||
+      skin.bind_positions.size() != n * 3 ||
+      (!skin.bind_normals.empty() && skin.bind_normals.size() != n * 3) ||
+      skin.geometry_to_bone.size() != num_bones * 16 ||
+      skin.bone_bounds.size() != num_bones * 6) {
+    return false;
+  }
+  for (uint16_t bone : skin.bone_indices) {
+    if (bone >= num_bones) {
+      return false;
+    }
+  }
+  for (uint32_t joint : skin.bone_joints) {
+    if (joint >= num_joints) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool load_model_cache(const char* path, ModelAsset& out) {
+  std::string cache_path = cache_path_for(path);
+  CacheReader reader;
+  if (!reader.Open(cache_path.c_str(), path)) {
+    return false;
+  }
+
+  size_t size = 0;
+  const ModelInfo* info = (const ModelInfo*)reader.Find(TagModelInfo, 0, &size);
+  if (!info || size != sizeof(ModelInfo)) {
+    return false;
+  }
+
+  ModelData& data = out.data;
+  bool ok = true;
+
+  out.meshes.resize(info->num_meshes);
+  for (uint32_t i = 0; ok && i < info->num_meshes; i++) {
+    const MeshInfo* mesh_info = (const MeshInfo*)reader.Find(TagMeshInfo, i, &size);
+    if (!mesh_info || size != sizeof(MeshInfo) || (mesh_info->index_size != 2 && mesh_info->index_size != 4)) {
+      ok = false;
+      break;
+    }
+
+    MeshView& view = out.meshes[i];
+    view.vertices = reader.FindArray<Vertex>(TagVertices, i, &view.num_vertices);
+    size_t index_bytes = 0;
+    view.indices = reader.Find(TagIndices, i, &index_bytes);
+    view.index_size = mesh_info->index_size;
+    view.num_indices = index_bytes / view.index_size;
+    view.skin = mesh_info->skin;
+    view.texture = mesh_info->texture;
+    const Aabb* bounds = (const Aabb*)reader.Find(TagMeshBounds, i, &size);
+    ok = view.vertices && view.indices && view.num_indices * view.index_size == index_bytes &&
+         indices_in_range(view) && bounds && size == sizeof(Aabb) &&
+         (view.skin < 0 || (uint32_t)view.skin < info->num_skins) &&
+         (view.texture < 0 || (uint32_t)view.texture < info->num_textures);
+    if (ok) {
+      view.bounds = *bounds;
+    }
+  }
+
+  std::string directory = directory_of(path);
+  data.textures.resize(ok ? info->num_textures : 0);
+  for (uint32_t i = 0; ok && i < info->num_textures; i++) {
+    const char* name = (const char*)reader.Find(TagTexturePath, i, &size);
+    ok = name && size > 0;
+    if (ok) {
+      std::string texture(name, size);
+      data.textures[i] = is_absolute_path(texture) ? texture : directory + texture;
+    }
+  }
+
+  Skeleton& skeleton = data.skeleton;
+  ok = ok && copy_chunk(reader, TagJointParents, 0, skeleton.parents);
+  ok = ok && copy_chunk(reader, TagJointNodes, 0, skeleton.joint_nodes);
+  ok = ok && copy_chunk(reader, TagJointRestT, 0, skeleton.rest.translations);
+  ok = ok && copy_chunk(reader, TagJointRestR, 0, skeleton.rest.rotations);
+  ok = ok && copy_chunk(reader, TagJointRestS, 0, skeleton.rest.scales);
+  ok = ok && copy_chunk(reader, TagJointBind, 0, skeleton.inverse_bind);
+  ok = ok && skeleton.Finish();
+
+  // Skin and clip arrays are bulk copied into their owning structs, only GPU data stays mapped.
+  data.skins.resize(ok ? info->num_skins : 0);
+  for (uint32_t i = 0; ok && i < info->num_skins; i++) {
+    const SkinInfo* skin_info = (const SkinInfo*)reader.Find(TagSkinInfo, i, &size);
+    if (!skin_info || size != sizeof(SkinInfo)) {
+      ok = false;
+      break;
+    }
+
+    SkinData& skin = data.skins[i];
+    skin.num_vertices = (size_t)skin_info->num_vertices;
+    skin.max_influences = skin_info->max_influences;
+    ok = copy_chunk(reader, TagSkinIndices, i, skin.bone_indices);
+    ok = ok && copy_chunk(reader, TagSkinWeights, i, skin.bone_weights);
+    ok = ok && copy_chunk(reader, TagSkinPositions, i, skin.bind_positions);
+    ok = ok && copy_chunk(reader, TagSkinNormals, i, skin.bind_normals);
+    ok = ok && copy_chunk(reader, TagSkinBones, i, skin.bone_joints);
+    ok = ok && copy_chunk(reader, TagSkinBind, i, skin.geometry_to_bone);
+    ok = ok && copy_chunk(reader, TagSkinBounds, i, skin.bone_bounds);
+    ok = ok && skin_consistent(skin, skeleton.NumJoints());
+  }
+
+  data.clips.resize(ok ? info->num_clips : 0);
+  for (uint32_t i = 0; ok && i < info->num_clips; i++) {
+    const ClipInfo* clip_info = (const ClipInfo*)reader.Find(TagClipInfo, i, &size);
+    if (!clip_info || size != sizeof(ClipInfo)) {
+      ok = false;
+      break;
+    }
+
+    AnimClip& clip = data.clips[i];
+    clip.duration = clip_info->duration;
+    clip.sample_rate = clip_info->sample_rate;
+    clip.num_frames = clip_info->num_frames;
+    clip.num_joints = clip_info->num_joints;
+    clip.max_error = clip_info->max_error;
+
+    const char* name = (const char*)reader.Find(TagClipName, i, &size);
+    clip.name.assign(name ? name : "", name ? size : 0);
+    ok = copy_chunk(reader, TagClipTracks, i, clip.tracks);
+    ok = ok && copy_chunk(reader, TagClipKeyFrames, i, clip.key_frames);
+    ok = ok && copy_chunk(reader, TagClipKeyValues, i, clip.key_values);
+    ok = ok && copy_chunk(reader, TagClipRanges, i, clip.ranges);
+    ok = ok && clip.num_joints == data.skeleton.NumJoints() && clip.tracks.size() == (size_t)clip.num_joints * 3 &&
+         clip.key_values.size() == clip.key_frames.size() * 3 && clip.ranges.size() == (size_t)clip.num_joints * 12;
+    for (size_t t = 0; ok && t < clip.tracks.size(); t++) {
+      const AnimTrack& track = clip.tracks[t];
+      ok = track.num_keys > 0 && (size_t)track.first_key + track.num_keys <= clip.key_frames.size();
+
+      // sample_clip() takes the first key as frame 0 and interpolates between
+      // strictly increasing key frames.
+      const uint16_t* frames = ok ? clip.key_frames.data() + track.first_key : nullptr;
+      ok = ok && frames[0] == 0 && frames[track.num_keys - 1] < clip.num_frames;
+      for (uint32_t k = 1; ok && k < track.num_keys; k++) {
+        ok = frames[k] > frames[k - 1];
+      }
+    }
+  }
+
+  if (!ok) {
+    fprintf(stderr, "Ignoring malformed cache %s\n", cache_path.c_str());
+    out = ModelAsset();
+    return false;
+  }
+
+  out.cache = reader.Release();
+  out.from_cache = true;
+  return true;
+}
+
+bool write_model_cache(const char* path, const ModelData& data) {
+  SourceStamp stamp;
+  if (!stat_source(path, true, stamp)) {
+    fprintf(stderr, "Failed to stat %s\n", path);
+    return false;
+  }
+
+  CacheWriter writer;
+  ModelInfo info = { (uint32_t)data.meshes.size(), (uint32_t)data.skins.size(), (uint32_t)data.clips.size(), (uint32_t)data.textures.size() };
+  writer.Add(TagModelInfo, 0, &info, sizeof(info));
+
+  std::vector<MeshInfo> mesh_infos(data.meshes.size());
+  for (uint32_t i = 0; i < data.meshes.size(); i++) {
+    const Mesh& mesh = data.meshes[i];
+    mesh_infos[i] = { mesh.index_size, mesh.skin, mesh.texture, 0 };
+    writer.Add(TagMeshInfo, i, &mesh_infos[i], sizeof(MeshInfo));
+    writer.AddArray(TagVertices, i, mesh.vertices);
+    writer.AddArray(TagIndices, i, mesh.index_data);
+    writer.Add(TagMeshBounds, i, &mesh.bounds, sizeof(Aabb));
+  }
+
+  std::string directory = directory_of(path);
+  std::vector<std::string> texture_names(data.textures.size());
+  for (uint32_t i = 0; i < data.textures.size(); i++) {
+    const std::string& texture = data.textures[i];
+    bool inside = !directory.empty() && texture.compare(0, directory.size(), directory) == 0;
+    texture_names[i] = inside ? texture.substr(directory.size()) : texture;
+    writer.Add(TagTexturePath, i, texture_names[i].data(), texture_names[i].size());
+  }
+
+  writer.AddArray(TagJointParents, 0, data.skeleton.parents);
+  writer.AddArray(TagJointNodes, 0, data.skeleton.joint_nodes);
+  writer.AddArray(TagJointRestT, 0, data.skeleton.rest.translations);
+  writer.AddArray(TagJointRestR, 0, data.skeleton.rest.rotations);
+  writer.AddArray(TagJointRestS, 0, data.skeleton.rest.scales);
+  writer.AddArray(TagJointBind, 0, data.skeleton.inverse_bind);
+
+  std::vector<SkinInfo> skin_infos(data.skins.size());
+  for (uint32_t i = 0; i < data.skins.size(); i++) {
+    const SkinData& skin = data.skins[i];
+    skin_infos[i] = { (uint64_t)skin.num_vertices, skin.max_influences, (uint32_t)skin.NumBones() };
+    writer.Add(TagSkinInfo, i, &skin_infos[i], sizeof(SkinInfo));
+    writer.AddArray(TagSkinIndices, i, skin.bone_indices);
+    writer.AddArray(TagSkinWeights, i, skin.bone_weights);
+    writer.AddArray(TagSkinPositions, i, skin.bind_positions);
+    writer.AddArray(TagSkinNormals, i, skin.bind_normals);
+    writer.AddArray(TagSkinBones, i, skin.bone_joints);
+    writer.AddArray(TagSkinBind, i, skin.geometry_to_bone);
+    writer.AddArray(TagSkinBounds, i, skin.bone_bounds);
+  }
+
+  std::vector<ClipInfo> clip_infos(data.clips.size());
+  for (uint32_t i = 0; i < data.clips.size(); i++) {
+    const AnimClip& clip = data.clips[i];
+    clip_infos[i] = { clip.duration, clip.sample_rate, clip.num_frames, clip.num_joints, clip.max_error, 0 };
+    writer.Add(TagClipInfo, i, &clip_infos[i], sizeof(ClipInfo));
+    writer.Add(TagClipName, i, clip.name.data(), clip.name.size());
+    writer.AddArray(TagClipTracks, i, clip.tracks);
+    writer.AddArray(TagClipKeyFrames, i, clip.key_frames);
+    writer.AddArray(TagClipKeyValues, i, clip.key_values);
+    writer.AddArray(TagClipRanges, i, clip.ranges);
+  }
+
+  std::string cache_path = cache_path_for(path);
+  return writer.Write(cache_path.c_str(), stamp);
+}
+
+// Box-filters RGBA8 level 0 down to 1x1, appending every level to pixels.
+int build_mip_chain(int width, int height, std::vector<uint8_t>& pixels, size_t* offsets) {
+  int num_mips = 1;
+  offsets[0] = 0;
+
+  while ((width > 1 || height > 1) && num_mips < MaxTextureMips) {
+    int mip_width = std::max(width / 2, 1);
+    int mip_height = std::max(height / 2, 1);
+
+    size_t src_offset = offsets[num_mips - 1];
+    size_t dst_offset = pixels.size();
+    pixels.resize(dst_offset + (size_t)mip_width * mip_height * 4);
+
+    const uint8_t* src = pixels.data() + src_offset;
+    uint8_t* dst = pixels.data() + dst_offset;
+    for (int y = 0; y < mip_height; y++) {
+      int y0 = std::min(y * 2, height - 1);
+      int y1 = std::min(y * 2 + 1, height - 1);
+      for (int x = 0; x < mip_width; x++) {
+        int x0 = std::min(x * 2, width - 1);
+        int x1 = std::min(x * 2 + 1, width - 1);
+        for (int c = 0; c < 4; c++) {
+          int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c]
+                  + src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+          dst[(y * mip_width + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+        }
+      }
+    }
+
+    offsets[num_mips++] = dst_offset;
+    width = mip_width;
+    height = mip_height;
+  }
+
+  return num_mips;
+}
+
+void print_mesh_stats(const ModelData& data) {
+  for (const Mesh& mesh : data.meshes) {
+    printf("  mesh %s: %zu vertices, %zu triangles, %d-bit indices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+        mesh.name.c_str(),
+        mesh.vertices.size(),
+        mesh.NumIndices() / 3,
+        (int)mesh.index_size * 8,
+        mesh.stats_before.acmr,
+        mesh.stats_after.acmr,
+        mesh.stats_before.atvr,
+        mesh.stats_after.atvr);
+  }
+}
+
+void print_clip_stats(const BakedClip& baked, const AnimClip& clip) {
+  printf("  clip %s: %u frames, %zu -> %zu bytes (%.1fx), %zu of %zu keys, max error %.5f\n",
+      clip.name.c_str(),
+      clip.num_frames,
+      baked.SizeBytes(),
+      clip.SizeBytes(),
+      (double)baked.SizeBytes() / (double)std::max<size_t>(clip.SizeBytes(), 1),
+      clip.NumKeys(),
+      (size_t)clip.num_frames * clip.num_joints * 3,
+      clip.max_error);
+}
+
+} // namespace
+
+bool load_texture_image(const char* path, TextureAsset& out) {
+  int width, height, channels;
+  stbi_set_flip_vertically_on_load_thread(true);
+  unsigned char* bytes = stbi_load(path, &width, &height, &channels, 4);
+  if (!bytes) {
+    fprintf(stderr, "Failed to load texture %s\n", path);
+    return false;
+  }
+
+  out.pixels.assign(bytes, bytes + (size_t)width * height * 4);
+  stbi_image_free(bytes);
+
+  size_t offsets[MaxTextureMips];
+  out.format = TextureFormat::Rgba8;
+  out.width = width;
+  out.height = height;
+  out.num_mips = build_mip_chain(width, height, out.pixels, offsets);
+  for (int i = 0; i < out.num_mips; i++) {
+    out.mips[i] = out.pixels.data() + offsets[i];
+  }
+  out.from_cache = false;
+  return true;
+}
+
+namespace {
+
+bool load_texture_cache(const char* path, TextureAsset& out) {
+  std::string cache_path = cache_path_for(path);
+  CacheReader reader;
+  if (!reader.Open(cache_path.c_str(), path)) {
+    return false;
+  }
+
+  size_t size = 0;
+  const TextureInfo* info = (const TextureInfo*)reader.Find(TagTextureInfo, 0, &size);
+  if (!info || size != sizeof(TextureInfo) || info->num_mips < 1 || info->num_mips > MaxTextureMips ||
+      info->format < TextureFormat::Rgba8 || info->format > TextureFormat::Bc7) {
+    return false;
+  }
+
+  out.format = info->format;
+  out.width = info->width;
+  out.height = info->height;
+  out.num_mips = info->num_mips;
+  for (int i = 0; i < info->num_mips; i++) {
+    out.mips[i] = (const uint8_t*)reader.Find(TagTextureMip, (uint32_t)i, &size);
+    if (!out.mips[i] || size != out.LevelSize(i)) {
+      fprintf(stderr, "Ignoring malformed cache %s\n", cache_path.c_str());
+      out = TextureAsset();
+      return false;
+    }
+  }
+
+  out.cache = reader.Release();
+  out.from_cache = true;
+  return true;
+}
+
+bool write_texture_cache(const char* path, const TextureAsset& texture) {
+  SourceStamp stamp;
+  if (!stat_source(path, true, stamp)) {
+    fprintf(stderr, "Failed to stat %s\n", path);
+    return false;
+  }
+
+  CacheWriter writer;
+  TextureInfo info = { texture.width, texture.height, texture.num_mips, texture.format };
+  writer.Add(TagTextureInfo, 0, &info, sizeof(info));
+  for (int i = 0; i < texture.num_mips; i++) {
+    writer.Add(TagTextureMip, (uint32_t)i, texture.mips[i], texture.LevelSize(i));
+  }
+
+  std::string cache_path = cache_path_for(path);
+  return writer.Write(cache_path.c_str(), stamp);
+}
+
+bool has_alpha(const TextureAsset& image) {
+  const uint8_t* pixels = image.mips[0];
+  for (size_t i = 0; i < (size_t)image.width * image.height; i++) {
+    if (pixels[i * 4 + 3] != 255) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Block compresses every level of an RGBA8 image into out.
+void compress_texture(const TextureAsset& image, TextureFormat format, TextureAsset& out) {
+  out = TextureAsset();
+  out.format = format;
+  out.width = image.width;
+  out.height = image.height;
+  out.num_mips = image.num_mips;
+
+  size_t offsets[MaxTextureMips];
+  for (int i = 0; i < out.num_mips; i++) {
+    offsets[i] = out.pixels.size();
+    out.pixels.resize(offsets[i] + out.LevelSize(i));
+    compress_texture_level(format, image.mips[i], out.LevelWidth(i), out.LevelHeight(i), out.pixels.data() + offsets[i]);
+  }
+  for (int i = 0; i < out.num_mips; i++) {
+    out.mips[i] = out.pixels.data() + offsets[i];
+  }
+}
+
+// Of level 0, alpha included only when the format keeps it.
+double texture_psnr(const TextureAsset& image, const TextureAsset& compressed) {
+  std::vector<uint8_t> decoded((size_t)image.width * image.height * 4);
+  decompress_texture_level(compressed.format, compressed.mips[0], image.width, image.height, decoded.data());
+
+  int channels = compressed.format == TextureFormat::Bc1 ? 3 : 4;
+  double error = 0.0;
+  for (size_t i = 0; i < decoded.size(); i += 4) {
+    for (int c = 0; c < channels; c++) {
+      double d = (double)image.mips[0][i + c] - (double)decoded[i + c];
+      error += d * d;
+    }
+  }
+  double mse = error / ((double)image.width * image.height * channels);
+  return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+GLenum texture_internal_format(TextureFormat format) {
+  switch (format) {
+    case TextureFormat::Bc1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TextureFormat::Bc3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TextureFormat::Bc7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    default: return GL_RGBA8;
+  }
+}
+
+} // namespace
+
+bool is_model_path(const char* path) {
+  size_t len = strlen(path);
+  return len >= 4 && (strcmp(path + len - 4, ".fbx") == 0 || strcmp(path + len - 4, ".FBX") == 0);
+}
+
+bool texture_format_supported(TextureFormat format) {
+  switch (format) {
+    case TextureFormat::Rgba8: return true;
+    case TextureFormat::Bc1:
+    case TextureFormat::Bc3: return GLEW_EXT_texture_compression_s3tc;
+    case TextureFormat::Bc7: return GLEW_ARB_texture_compression_bptc || GLEW_VERSION_4_2;
+  }
+  return false;
+}
+
+void upload_texture(GLuint texture, const TextureAsset& asset) {
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  // Trilinear over the baked chain, a single level has nothing to blend between.
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, asset.num_mips > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, asset.num_mips - 1);
+
+  for (int level = 0; level < asset.num_mips; level++) {
+    upload_texture_level(asset, level);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+size_t upload_texture_level(const TextureAsset& asset, int level, FrameArena* scratch) {
+  int width = asset.LevelWidth(level);
+  int height = asset.LevelHeight(level);
+  if (asset.format == TextureFormat::Rgba8) {
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, asset.mips[level]);
+    BONES_COUNT(ProfileCounter::BytesUploaded, asset.LevelSize(level));
+    return asset.LevelSize(level);
+  }
+
+  if (texture_format_supported(asset.format)) {
+    size_t size = asset.LevelSize(level);
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, texture_internal_format(asset.format), width, height, 0, (GLsizei)size, asset.mips[level]);
+    BONES_COUNT(ProfileCounter::BytesUploaded, size);
+    return size;
+  }
+
+  size_t size = texture_level_size(TextureFormat::Rgba8, width, height);
+  std::vector<uint8_t> owned(scratch ? 0 : size);
+  uint8_t* decoded = scratch ? scratch->Allocate<uint8_t>(size) : owned.data();
+  decompress_texture_level(asset.format, asset.mips[level], width, height, decoded);
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, decoded);
+  BONES_COUNT(ProfileCounter::BytesUploaded, size);
+  return size;
+}
+
+bool load_fbx(const char* path, ModelData& out, ThreadPool* pool) {
+  ufbx_load_opts opts = {0};
+  opts.generate_missing_normals = true;
+  set_ufbx_allocator(opts.temp_allocator, asset_pool());
+  set_ufbx_allocator(opts.result_allocator, asset_pool());
+  if (pool) {
+    opts.thread_opts.pool = make_fbx_thread_pool(*pool);
+  }
+  ufbx_error error;
+  ufbx_scene *scene = ufbx_load_file(path, &opts, &error);
+
+  if (!scene) {
+    fprintf(stderr, "Failed to load: %s\n", error.description.data);
+    return false;
+  }
+
+  if (!out.skeleton.Build(scene)) {
+    fprintf(stderr, "Failed to build the skeleton of %s\n", path);
+    ufbx_free_scene(scene);
+    return false;
+  }
+
+  // Files ufbx resolved next to the model, embedded images are not supported.
+  out.textures.clear();
+  for (const ufbx_texture_file& file : scene->texture_files) {
+    out.textures.emplace_back(file.filename.data, file.filename.length);
+  }
+
+  out.meshes.resize(scene->meshes.count);
+  for (size_t i = 0; i < scene->meshes.count; i++) {
+    ufbx_mesh* mesh = scene->meshes[i];
+    Mesh& out_mesh = out.meshes[i];
+    if (!out_mesh.Build(mesh)) {
+      ufbx_free_scene(scene);
+      return false;
+    }
+
+    // The base colour map of the first material stands for the whole mesh.
+    const ufbx_material* material = mesh->materials.count > 0 ? mesh->materials.data[0] : nullptr;
+    const ufbx_texture* texture = material ? material->pbr.base_color.texture : nullptr;
+    if (material && !texture) {
+      texture = material->fbx.diffuse_color.texture;
+    }
+    if (texture && texture->has_file && texture->file_index < out.textures.size()) {
+      out_mesh.texture = (int32_t)texture->file_index;
+    }
+
+    if (mesh->skin_deformers.count > 0 && !out_mesh.vertices.empty()) {
+      SkinData skin;
+      const Vertex* vertices = out_mesh.vertices.data();
+      if (build_skin_data(mesh->skin_deformers[0], out_mesh.vertices.size(), out_mesh.vertex_ids.data(),
+                          vertices[0].position, vertices[0].normal, sizeof(Vertex) / sizeof(float), SkinInfluences, skin)) {
+        for (uint32_t& bone : skin.bone_joints) {
+          bone = out.skeleton.node_joints[bone];
+        }
+        out_mesh.skin = (int32_t)out.skins.size();
+        out.skins.push_back(std::move(skin));
+      }
+    }
+  }
+
+  std::vector<BakedClip> baked;
+  bool ok = bake_anim_clips(scene, out.skeleton, DefaultAnimSampleRate, baked);
+  ufbx_free_scene(scene);
+
+  out.clips.resize(ok ? baked.size() : 0);
+  for (size_t i = 0; ok && i < baked.size(); i++) {
+    ok = compress_clip(baked[i], out.skeleton, AnimCompressionOptions(), out.clips[i]);
+    if (ok) {
+      print_clip_stats(baked[i], out.clips[i]);
+    }
+  }
+  return ok;
+}
+
+bool load_model(const char* path, ModelAsset& out, ThreadPool* pool) {
+  Clock::time_point start = Clock::now();
+
+  out = ModelAsset();
+  if (load_model_cache(path, out)) {
+    printf("Loaded %s from cache in %.2f ms\n", path, elapsed_ms(start));
+    return true;
+  }
+
+  if (!load_fbx(path, out.data, pool)) {
+    return false;
+  }
+
+  out.meshes.reserve(out.data.meshes.size());
+  for (const Mesh& mesh : out.data.meshes) {
+    out.meshes.push_back(mesh.View());
+  }
+  printf("Loaded %s from fbx in %.2f ms\n", path, elapsed_ms(start));
+  print_mesh_stats(out.data);
+  return true;
+}
+
+bool load_texture(const char* path, TextureAsset& out, bool verbose) {
+  Clock::time_point start = Clock::now();
+
+  out = TextureAsset();
+  if (load_texture_cache(path, out)) {
+    if (verbose) {
+      printf("Loaded %s from cache in %.2f ms\n", path, elapsed_ms(start));
+    }
+    return true;
+  }
+
+  if (!load_texture_image(path, out)) {
+    return false;
+  }
+
+  if (verbose) {
+    printf("Loaded %s from image in %.2f ms\n", path, elapsed_ms(start));
+  }
+  return true;
+}
+
+bool bake_model(const char* path, bool high_quality) {
+  Clock::time_point start = Clock::now();
+  ModelData data;
+  if (!load_fbx(path, data)) {
+    return false;
+  }
+  double source_ms = elapsed_ms(start);
+
+  if (!write_model_cache(path, data)) {
+    return false;
+  }
+
+  start = Clock::now();
+  ModelAsset cached;
+  if (!load_model_cache(path, cached)) {
+    fprintf(stderr, "Failed to read back cache for %s\n", path);
+    return false;
+  }
+  double cache_ms = elapsed_ms(start);
+
+  printf("Baked %s: %zu meshes, %zu skins, %zu clips\n", path, data.meshes.size(), data.skins.size(), data.clips.size());
+  print_mesh_stats(data);
+  printf("  fbx load %.2f ms, cache load %.2f ms (%.1fx)\n", source_ms, cache_ms, source_ms / std::max(cache_ms, 1e-3));
+
+  bool ok = true;
+  for (const std::string& texture : data.textures) {
+    ok = bake_texture(texture.c_str(), high_quality) && ok;
+  }
+  return ok;
+}
+
+bool bake_texture(const char* path, bool high_quality) {
+  Clock::time_point start = Clock::now();
+  TextureAsset image;
+  if (!load_texture_image(path, image)) {
+    return false;
+  }
+  double source_ms = elapsed_ms(start);
+
+  start = Clock::now();
+  TextureFormat format = high_quality ? TextureFormat::Bc7 : has_alpha(image) ? TextureFormat::Bc3 : TextureFormat::Bc1;
+  TextureAsset texture;
+  compress_texture(image, format, texture);
+  double encode_ms = elapsed_ms(start);
+
+  if (!write_texture_cache(path, texture)) {
+    return false;
+  }
+
+  start = Clock::now();
+  TextureAsset cached;
+  if (!load_texture_cache(path, cached)) {
+    fprintf(stderr, "Failed to read back cache for %s\n", path);
+    return false;
+  }
+  double cache_ms = elapsed_ms(start);
+
+  printf("Baked %s: %dx%d, %d mips, %s %zu -> %zu bytes (%.1fx), %.2f dB PSNR, encoded in %.2f ms\n",
+      path,
+      texture.width,
+      texture.height,
+      texture.num_mips,
+      texture_format_name(texture.format),
+      image.pixels.size(),
+      texture.pixels.size(),
+      (double)image.pixels.size() / (double)std::max<size_t>(texture.pixels.size(), 1),
+      texture_psnr(image, texture),
+      encode_ms);
+  printf("  image load %.2f ms, cache load %.2f ms (%.1fx)\n", source_ms, cache_ms, source_ms / std::max(cache_ms, 1e-3));
+  return true;
+}
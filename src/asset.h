@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "animation.h"
+#include "mapped_file.h"
+#include "mesh.h"
+#include "skeleton.h"
+#include "skinning.h"
+#include "texture_codec.h"
+
+class FrameArena;
+class ThreadPool;
+
+constexpr int SkinInfluences = 4;
+constexpr int MaxTextureMips = 16;
+
+struct ModelData {
+  std::vector<Mesh> meshes;
+  std::vector<SkinData> skins;
+  std::vector<AnimClip> clips;
+
+  // Files of the material textures meshes refer to by index.
+  std::vector<std::string> textures;
+
+  // Clips and skin bones are in its joint order.
+  Skeleton skeleton;
+};
+
+// A model ready for upload. The mesh views point either into data.meshes or
+// straight into the mapped cache, so they go to glBufferData without a copy.
+struct ModelAsset {
+  ModelData data;
+  MappedFile cache;
+  bool from_cache = false;
+
+  std::vector<MeshView> meshes;
+};
+
+// Texture with its full mip chain, mips point into pixels or the mapped cache.
+// Baked caches hold block compressed mips, images load as RGBA8.
+struct TextureAsset {
+  std::vector<uint8_t> pixels;
+  MappedFile cache;
+  bool from_cache = false;
+
+  TextureFormat format = TextureFormat::Rgba8;
+  int width = 0;
+  int height = 0;
+  int num_mips = 0;
+  const uint8_t* mips[MaxTextureMips] = {};
+
+  int LevelWidth(int level) const { return width >> level > 1 ? width >> level : 1; }
+  int LevelHeight(int level) const { return height >> level > 1 ? height >> level : 1; }
+  size_t LevelSize(int level) const { return texture_level_size(format, LevelWidth(level), LevelHeight(level)); }
+};
+
+// Parses the source asset, ufbx spreads its parse tasks over pool when given.
+bool load_fbx(const char* path, ModelData& out, ThreadPool* pool = nullptr);
+bool load_texture_image(const char* path, TextureAsset& out);
+
+// Loads from "<path>.bcache" when it is up to date, otherwise parses the source.
+bool load_model(const char* path, ModelAsset& out, ThreadPool* pool = nullptr);
+bool load_texture(const char* path, TextureAsset& out, bool verbose = true);
+
+bool is_model_path(const char* path);
+
+// Block formats the driver samples directly, the others are decoded on upload.
+bool texture_format_supported(TextureFormat format);
+
+// Uploads the mip chain into texture, which is left unbound.
+void upload_texture(GLuint texture, const TextureAsset& asset);
+
+// Uploads one level into the texture bound to GL_TEXTURE_2D, returns the bytes it takes on the GPU.
+// Levels in a format the driver cannot sample are decoded into scratch when given.
+size_t upload_texture_level(const TextureAsset& asset, int level, FrameArena* scratch = nullptr);
+
+// Writes the cache for a source asset and reports load times of both paths.
+// Models bake the textures they reference too. Textures are stored as BC1 when
+// opaque and BC3 otherwise, or BC7 for both with high_quality.
+bool bake_model(const char* path, bool high_quality = false);
+bool bake_texture(const char* path, bool high_quality = false);
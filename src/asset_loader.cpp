@@ -0,0 +1,56 @@
+#include "asset_loader.h"
+
+#include <chrono>
+#include <thread>
+
+#include "profiler.h"
+#include "thread_pool.h"
+
+AssetLoader::AssetLoader(ThreadPool& pool) : pool(pool) {}
+
+AssetLoader::~AssetLoader() {
+  // Tasks still hold this, wait for them before the queue goes away.
+  while (running.load(std::memory_order_acquire) > 0) {
+    if (!pool.RunPendingTask()) {
+      std::this_thread::yield();
+    }
+  }
+
+  LoadedAsset* asset;
+  while (finished.TryPop(asset)) {
+    delete asset;
+  }
+}
+
+void AssetLoader::Request(const char* path) {
+  LoadedAsset* asset = new LoadedAsset();
+  asset->path = path;
+  asset->kind = is_model_path(path) ? LoadedAsset::Kind::Model : LoadedAsset::Kind::Texture;
+
+  pending.fetch_add(1, std::memory_order_relaxed);
+  running.fetch_add(1, std::memory_order_relaxed);
+  pool.Submit([this, asset] {
+    BONES_ZONE("load asset");
+    auto start = std::chrono::steady_clock::now();
+    if (asset->kind == LoadedAsset::Kind::Model) {
+      asset->ok = load_model(asset->path.c_str(), asset->model, &pool);
+    } else {
+      asset->ok = load_texture(asset->path.c_str(), asset->texture);
+    }
+    asset->load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    finished.Push(asset);
+    running.fetch_sub(1, std::memory_order_release);
+  });
+}
+
+bool AssetLoader::Poll(std::unique_ptr<LoadedAsset>& out) {
+  LoadedAsset* asset;
+  if (!finished.TryPop(asset)) {
+    return false;
+  }
+
+  out.reset(asset);
+  pending.fetch_sub(1, std::memory_order_release);
+  return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "asset.h"
+#include "mpsc_queue.h"
+
+class ThreadPool;
+
+struct LoadedAsset {
+  enum class Kind { Model, Texture };
+
+  std::string path;
+  Kind kind = Kind::Model;
+  bool ok = false;
+  double load_ms = 0.0;
+
+  ModelAsset model;
+  TextureAsset texture;
+};
+
+// Loads assets on a thread pool and hands them back to the GL thread through a
+// lock-free queue, so the render loop never blocks on disk or parsing.
+class AssetLoader {
+public:
+  explicit AssetLoader(ThreadPool& pool);
+  ~AssetLoader();
+
+  AssetLoader(const AssetLoader&) = delete;
+  AssetLoader& operator=(const AssetLoader&) = delete;
+
+  // Picks model or texture loading from the extension.
+  void Request(const char* path);
+
+  // Called from the GL thread, returns false when nothing has finished yet.
+  bool Poll(std::unique_ptr<LoadedAsset>& out);
+
+  // Requests that have not been polled yet.
+  size_t Pending() const { return pending.load(std::memory_order_acquire); }
+
+private:
+  ThreadPool& pool;
+  MpscQueue<LoadedAsset*> finished;
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> running{0};
+};
@@ -0,0 +1,419 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "allocators.h"
+#include "animation.h"
+#include "asset_loader.h"
+#include "simd.h"
+#include "skeleton.h"
+#include "skinning.h"
+#include "thread_pool.h"
+#include "ufbx.h"
+
+namespace {
+
+constexpr size_t TargetCrowdVertices = 2'000'000;
+constexpr size_t TargetCrowdJoints = 250'000;
+constexpr size_t TargetSampledJoints = 2'000'000;
+constexpr int WarmupIterations = 2;
+constexpr int TimedIterations = 10;
+constexpr int SyntheticBones = 32;
+constexpr size_t LoadingBatch = 32;
+
+struct SkinJob {
+  const SkinData* skin;
+  SkinPose pose;
+  float* out_positions;
+};
+
+// Chain of bones along the mesh Y extent with distance falloff weights, used when
+// the asset has no skin deformer so the kernels still get realistic input.
+void build_synthetic_skin(const ufbx_mesh* mesh, int max_influences, SkinData& out) {
+  size_t n = mesh->num_vertices;
+  out.num_vertices = n;
+  out.max_influences = max_influences;
+  out.bone_indices.assign(n * max_influences, 0);
+  out.bone_weights.assign(n * max_influences, 0.0f);
+  out.bind_positions.resize(n * 3);
+  out.bind_normals.clear();
+
+  float min_y = INFINITY, max_y = -INFINITY;
+  for (size_t v = 0; v < n; v++) {
+    min_y = std::min(min_y, (float)mesh->vertices.data[v].y);
+    max_y = std::max(max_y, (float)mesh->vertices.data[v].y);
+  }
+  float spacing = std::max(max_y - min_y, 1e-3f) / (SyntheticBones - 1);
+
+  for (size_t v = 0; v < n; v++) {
+    const ufbx_vec3& p = mesh->vertices.data[v];
+    out.bind_positions[v * 3 + 0] = (float)p.x;
+    out.bind_positions[v * 3 + 1] = (float)p.y;
+    out.bind_positions[v * 3 + 2] = (float)p.z;
+
+    int nearest = (int)std::lround(((float)p.y - min_y) / spacing);
+    float total = 0.0f;
+    for (int k = 0; k < max_influences; k++) {
+      int bone = std::clamp(nearest + (k % 2 == 0 ? k / 2 : -(k + 1) / 2), 0, SyntheticBones - 1);
+      float w = 1.0f / (1.0f + (float)(k * k));
+      out.bone_indices[k * n + v] = (uint16_t)bone;
+      out.bone_weights[k * n + v] = w;
+      total += w;
+    }
+    for (int k = 0; k < max_influences; k++) {
+      out.bone_weights[k * n + v] /= total;
+    }
+  }
+
+  out.bone_joints.assign(SyntheticBones, 0);
+  out.geometry_to_bone.resize(SyntheticBones * 16);
+  for (int b = 0; b < SyntheticBones; b++) {
+    mat4_identity(out.geometry_to_bone.data() + b * 16);
+  }
+}
+
+// Bind palette with a per-instance twist, so every instance skins to different
+// results and the work cannot be collapsed into one.
+void build_bench_palette(size_t num_bones, size_t instance, float* out) {
+  for (size_t b = 0; b < num_bones; b++) {
+    float angle = 0.01f * (float)(instance + b);
+    float* m = out + b * 16;
+    mat4_identity(m);
+    m[0] = std::cos(angle);
+    m[2] = -std::sin(angle);
+    m[8] = std::sin(angle);
+    m[10] = std::cos(angle);
+    m[12] = (float)instance;
+  }
+}
+
+double run_crowd(ThreadPool& pool, const std::vector<SkinJob>& jobs, const std::vector<size_t>& offsets, SkinningMethod method) {
+  size_t total = offsets.back();
+
+  auto skin_crowd = [&] {
+    pool.ParallelFor(total, 4096, [&](size_t begin, size_t end) {
+      size_t j = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+      while (begin < end) {
+        size_t job_end = std::min(end, offsets[j + 1]);
+        const SkinJob& job = jobs[j];
+        skin_vertices_range(*job.skin, job.pose, method, begin - offsets[j], job_end - offsets[j], job.out_positions, nullptr);
+        begin = job_end;
+        j++;
+      }
+    });
+  };
+
+  for (int i = 0; i < WarmupIterations; i++) {
+    skin_crowd();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < TimedIterations; i++) {
+    skin_crowd();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  return (double)total * TimedIterations / elapsed.count();
+}
+
+// Powers of two up to the hardware thread count, which is always included.
+std::vector<size_t> bench_thread_counts() {
+  unsigned hw_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<size_t> thread_counts;
+  for (size_t t = 1; t < hw_threads; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(hw_threads);
+  return thread_counts;
+}
+
+} // namespace
+
+int run_skinning_benchmark(const char* path) {
+  ufbx_load_opts opts = {0};
+  ufbx_error error;
+  ufbx_scene* scene = ufbx_load_file(path, &opts, &error);
+
+  if (!scene) {
+    fprintf(stderr, "Failed to load: %s\n", error.description.data);
+    return 1;
+  }
+
+  std::vector<float> node_to_world(scene->nodes.count * 16);
+  for (size_t i = 0; i < scene->nodes.count; i++) {
+    mat4_from_ufbx(scene->nodes.data[i]->node_to_world, node_to_world.data() + i * 16);
+  }
+
+  printf("skinning benchmark: %s\n", path);
+  printf("%8s %6s %5s %14s %16s %10s\n", "threads", "method", "infl", "Mverts/s", "Mverts/s/thread", "scaling");
+
+  std::vector<size_t> thread_counts = bench_thread_counts();
+
+  for (int max_influences : {4, 8}) {
+    std::vector<SkinData> skins;
+    for (size_t i = 0; i < scene->meshes.count; i++) {
+      ufbx_mesh* mesh = scene->meshes.data[i];
+      SkinData skin;
+      if (mesh->skin_deformers.count > 0 && build_skin_data(mesh, mesh->skin_deformers.data[0], max_influences, skin)) {
+        skins.push_back(std::move(skin));
+      }
+    }
+
+    bool synthetic = skins.empty();
+    if (synthetic) {
+      for (size_t i = 0; i < scene->meshes.count; i++) {
+        SkinData skin;
+        build_synthetic_skin(scene->meshes.data[i], max_influences, skin);
+        skins.push_back(std::move(skin));
+      }
+    }
+
+    size_t mesh_vertices = 0;
+    for (const SkinData& skin : skins) {
+      mesh_vertices += skin.num_vertices;
+    }
+    if (mesh_vertices == 0) {
+      fprintf(stderr, "No vertices to skin in %s\n", path);
+      ufbx_free_scene(scene);
+      return 1;
+    }
+
+    size_t instances = std::max<size_t>(1, TargetCrowdVertices / mesh_vertices);
+    if (max_influences == 4) {
+      printf("%zu mesh vertices x %zu instances%s\n", mesh_vertices, instances, synthetic ? " (synthetic rig)" : "");
+    }
+
+    std::vector<std::unique_ptr<float[]>> palettes;
+    std::vector<std::unique_ptr<DualQuat[]>> dual_quats;
+    std::vector<std::unique_ptr<float[]>> outputs;
+    std::vector<SkinJob> jobs;
+    std::vector<size_t> offsets = {0};
+
+    for (size_t instance = 0; instance < instances; instance++) {
+      for (const SkinData& skin : skins) {
+        size_t num_bones = skin.NumBones();
+        palettes.emplace_back(new float[num_bones * 16]);
+        if (synthetic) {
+          build_bench_palette(num_bones, instance, palettes.back().get());
+        } else {
+          build_skin_palette(skin, node_to_world.data(), palettes.back().get());
+        }
+        dual_quats.emplace_back(new DualQuat[num_bones]);
+        build_dual_quats(palettes.back().get(), num_bones, dual_quats.back().get());
+        outputs.emplace_back(new float[skin.num_vertices * 3]);
+
+        SkinJob job;
+        job.skin = &skin;
+        job.pose.palette = palettes.back().get();
+        job.pose.dual_quats = dual_quats.back().get();
+        job.out_positions = outputs.back().get();
+        jobs.push_back(job);
+        offsets.push_back(offsets.back() + skin.num_vertices);
+      }
+    }
+
+    for (SkinningMethod method : {SkinningMethod::Linear, SkinningMethod::DualQuaternion}) {
+      double single_thread = 0.0;
+      for (size_t threads : thread_counts) {
+        ThreadPool pool(threads);
+        double rate = run_crowd(pool, jobs, offsets, method);
+        if (threads == 1) {
+          single_thread = rate;
+        }
+        printf("%8zu %6s %5d %14.2f %16.2f %9.0f%%\n",
+            threads,
+            method == SkinningMethod::Linear ? "lbs" : "dqs",
+            max_influences,
+            rate * 1e-6,
+            rate * 1e-6 / (double)threads,
+            100.0 * rate / (single_thread * (double)threads));
+      }
+    }
+  }
+
+  // Local-to-model propagation of the scene skeleton, rest pose on every instance.
+  Skeleton skeleton;
+  if (skeleton.Build(scene) && skeleton.NumJoints() > 0) {
+    size_t instances = std::max<size_t>(1, TargetCrowdJoints / skeleton.NumJoints());
+    std::vector<Pose> poses(instances, skeleton.rest);
+    std::vector<float> joint_to_model(instances * skeleton.NumJoints() * 16);
+
+    printf("pose propagation: %zu joints x %zu instances\n", skeleton.NumJoints(), instances);
+    printf("%8s %14s %16s\n", "threads", "Mjoints/s", "Mjoints/s/thread");
+    for (size_t threads : thread_counts) {
+      ThreadPool pool(threads);
+      for (int i = 0; i < WarmupIterations; i++) {
+        local_to_model_batch(skeleton, poses.data(), instances, &pool, joint_to_model.data());
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < TimedIterations; i++) {
+        local_to_model_batch(skeleton, poses.data(), instances, &pool, joint_to_model.data());
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      double rate = (double)(instances * skeleton.NumJoints()) * TimedIterations / elapsed.count();
+      printf("%8zu %14.2f %16.2f\n", threads, rate * 1e-6, rate * 1e-6 / (double)threads);
+    }
+  }
+
+  ufbx_free_scene(scene);
+  return 0;
+}
+
+int run_animation_benchmark(const char* path, float max_error) {
+  ufbx_load_opts opts = {0};
+  ufbx_error error;
+  ufbx_scene* scene = ufbx_load_file(path, &opts, &error);
+  if (!scene) {
+    fprintf(stderr, "Failed to load: %s\n", error.description.data);
+    return 1;
+  }
+
+  Skeleton skeleton;
+  std::vector<BakedClip> clips;
+  bool ok = skeleton.Build(scene) && bake_anim_clips(scene, skeleton, DefaultAnimSampleRate, clips);
+  ufbx_free_scene(scene);
+  if (!ok) {
+    return 1;
+  }
+  if (clips.empty()) {
+    fprintf(stderr, "No animation in %s\n", path);
+    return 1;
+  }
+
+  std::vector<float> bounds = {0.001f, 0.01f, 0.1f};
+  if (max_error > 0.0f) {
+    bounds = {max_error};
+  }
+
+  // Samples spread over the clip at a step unrelated to the frame rate, the same times for both.
+  auto sample_rate = [&](auto& clip, size_t samples) {
+    Pose pose;
+    float step = clip.duration * 0.6180339f + 0.01f;
+    float time = 0.0f;
+    for (size_t i = 0; i < samples / 8; i++) {
+      sample_clip(clip, time += step, true, pose);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples; i++) {
+      sample_clip(clip, time += step, true, pose);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return (double)(samples * clip.num_joints) / elapsed.count();
+  };
+
+  printf("animation benchmark: %s, %zu joints\n", path, skeleton.NumJoints());
+  printf("%-16s %8s %8s %10s %10s %8s %8s %10s %10s %12s %12s\n",
+      "clip", "frames", "bound", "baked KB", "packed KB", "ratio", "keys %", "max error", "pack ms", "baked Mj/s", "packed Mj/s");
+
+  for (const BakedClip& baked : clips) {
+    size_t samples = std::max<size_t>(1, TargetSampledJoints / std::max<size_t>(baked.num_joints, 1));
+    double baked_rate = sample_rate(baked, samples);
+
+    for (float bound : bounds) {
+      AnimCompressionOptions options;
+      options.max_error = bound;
+
+      AnimClip clip;
+      auto start = std::chrono::steady_clock::now();
+      if (!compress_clip(baked, skeleton, options, clip)) {
+        return 1;
+      }
+      std::chrono::duration<double, std::milli> compress_ms = std::chrono::steady_clock::now() - start;
+
+      printf("%-16s %8u %8g %10.1f %10.1f %8.1f %8.1f %10.5f %10.1f %12.2f %12.2f\n",
+          baked.name.c_str(),
+          baked.num_frames,
+          bound,
+          (double)baked.SizeBytes() / 1024.0,
+          (double)clip.SizeBytes() / 1024.0,
+          (double)baked.SizeBytes() / (double)clip.SizeBytes(),
+          100.0 * (double)clip.NumKeys() / (double)(baked.num_frames * baked.num_joints * 3),
+          clip.max_error,
+          compress_ms.count(),
+          baked_rate * 1e-6,
+          sample_rate(clip, samples) * 1e-6);
+    }
+  }
+  return 0;
+}
+
+int run_loading_benchmark(const std::vector<const char*>& paths) {
+  struct Result {
+    size_t threads;
+    double first_ms;
+    double total_ms;
+    size_t failed;
+  };
+
+  size_t num_assets = std::max(LoadingBatch, paths.size());
+  std::vector<Result> results;
+
+  for (size_t threads : bench_thread_counts()) {
+    ThreadPool pool(threads);
+    AssetLoader loader(pool);
+
+    Result result = {threads, 0.0, 0.0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_assets; i++) {
+      loader.Request(paths[i % paths.size()]);
+    }
+
+    // The polling thread counts as one of the threads, so it helps with loads too.
+    size_t received = 0;
+    while (received < num_assets) {
+      std::unique_ptr<LoadedAsset> asset;
+      if (!loader.Poll(asset)) {
+        if (!pool.RunPendingTask()) {
+          std::this_thread::yield();
+        }
+        continue;
+      }
+
+      if (received++ == 0) {
+        result.first_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+      result.failed += asset->ok ? 0 : 1;
+    }
+    result.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    results.push_back(result);
+  }
+
+  printf("loading benchmark: %zu assets from %zu files\n", num_assets, paths.size());
+  printf("%8s %12s %12s %10s %10s\n", "threads", "first ms", "total ms", "assets/s", "speedup");
+  for (const Result& result : results) {
+    printf("%8zu %12.2f %12.2f %10.1f %9.2fx\n",
+        result.threads,
+        result.first_ms,
+        result.total_ms,
+        1000.0 * (double)num_assets / result.total_ms,
+        results[0].total_ms / result.total_ms);
+  }
+
+  // Loads parsed from source run ufbx on the asset pool, cached ones never touch it.
+  PoolStats pool = asset_pool().Stats();
+  printf("asset pool: %.2f MB reserved, %.2f MB peak in use, %llu of %llu allocations reused, %.2f MB above the classes now\n",
+      (double)pool.reserved_bytes / (1024.0 * 1024.0),
+      (double)pool.peak_used_bytes / (1024.0 * 1024.0),
+      (unsigned long long)pool.reused,
+      (unsigned long long)pool.allocations,
+      (double)pool.large_bytes / (1024.0 * 1024.0));
+
+  size_t failed = 0;
+  for (const Result& result : results) {
+    failed += result.failed;
+  }
+  if (failed > 0) {
+    fprintf(stderr, "%zu loads failed\n", failed);
+    return 1;
+  }
+  return 0;
+}
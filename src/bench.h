@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+
+// Skins every skinned mesh in the FBX (or a synthetic rig when it has none) as a crowd
+// and prints vertices skinned per second for each thread count, then the same for
+// skeleton pose propagation in joints per second.
+int run_skinning_benchmark(const char* path);
+
+// Compresses every clip in the FBX at max_error (a range of bounds when 0) and
+// prints size, compression ratio, measured error and sampling throughput of the
+// compressed clip against the baked one.
+int run_animation_benchmark(const char* path, float max_error);
+
+// Loads the assets (repeated up to a fixed batch) through the async loader for
+// each thread count and prints assets per second and speedup over one thread.
+int run_loading_benchmark(const std::vector<const char*>& paths);
@@ -0,0 +1,182 @@
+#include "cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+constexpr size_t CacheAlignment = 64;
+
+static size_t align_up(size_t value) {
+  return (value + CacheAlignment - 1) & ~(CacheAlignment - 1);
+}
+
+static uint64_t hash_bytes(const uint8_t* data, size_t size) {
+  // FNV-1a, 64-bit
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string cache_path_for(const char* source_path) {
+  return std::string(source_path) + ".bcache";
+}
+
+bool stat_source(const char* path, bool with_hash, SourceStamp& out) {
+  std::error_code ec;
+  uintmax_t size = std::filesystem::file_size(path, ec);
+  if (ec) {
+    return false;
+  }
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return false;
+  }
+
+  out.size = (uint64_t)size;
+  out.mtime = (int64_t)mtime.time_since_epoch().count();
+  out.hash = 0;
+
+  if (with_hash) {
+    MappedFile file;
+    if (!file.Open(path)) {
+      return false;
+    }
+    out.hash = hash_bytes(file.Data(), file.Size());
+  }
+
+  return true;
+}
+
+void CacheWriter::Add(uint32_t tag, uint32_t index, const void* data, size_t size) {
+  chunks.push_back({ tag, index, data, size });
+}
+
+bool CacheWriter::Write(const char* path, const SourceStamp& source) const {
+  std::vector<CacheChunk> table(chunks.size());
+  size_t offset = align_up(sizeof(CacheHeader) + sizeof(CacheChunk) * chunks.size());
+  for (size_t i = 0; i < chunks.size(); i++) {
+    table[i] = { chunks[i].tag, chunks[i].index, offset, chunks[i].size };
+    offset = align_up(offset + chunks[i].size);
+  }
+
+  CacheHeader header = {};
+  header.magic = CacheMagic;
+  header.version = CacheVersion;
+  header.source = source;
+  header.num_chunks = (uint32_t)chunks.size();
+
+  // Write beside the target and rename, so a reader never maps a half-written cache.
+  std::string temp_path = std::string(path) + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to open %s for writing\n", temp_path.c_str());
+    return false;
+  }
+
+  static const uint8_t padding[CacheAlignment] = {};
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && (table.empty() || fwrite(table.data(), sizeof(CacheChunk), table.size(), file) == table.size());
+
+  size_t written = sizeof(header) + sizeof(CacheChunk) * table.size();
+  for (size_t i = 0; ok && i < chunks.size(); i++) {
+    size_t pad = table[i].offset - written;
+    ok = fwrite(padding, 1, pad, file) == pad;
+    ok = ok && (chunks[i].size == 0 || fwrite(chunks[i].data, 1, chunks[i].size, file) == chunks[i].size);
+    written = table[i].offset + chunks[i].size;
+  }
+
+  ok = fclose(file) == 0 && ok;
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", temp_path.c_str());
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(temp_path, path, ec);
+  if (ec) {
+    fprintf(stderr, "Failed to replace %s: %s\n", path, ec.message().c_str());
+    std::remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool CacheReader::Open(const char* cache_path, const char* source_path) {
+  chunks = nullptr;
+  num_chunks = 0;
+
+  if (!file.Open(cache_path)) {
+    return false;
+  }
+
+  if (file.Size() < sizeof(CacheHeader)) {
+    file.Close();
+    return false;
+  }
+
+  CacheHeader header;
+  memcpy(&header, file.Data(), sizeof(header));
+  if (header.magic != CacheMagic || header.version != CacheVersion) {
+    file.Close();
+    return false;
+  }
+
+  size_t table_end = sizeof(CacheHeader) + sizeof(CacheChunk) * (size_t)header.num_chunks;
+  if (table_end > file.Size()) {
+    file.Close();
+    return false;
+  }
+
+  const CacheChunk* table = (const CacheChunk*)(file.Data() + sizeof(CacheHeader));
+  for (uint32_t i = 0; i < header.num_chunks; i++) {
+    if (table[i].offset > file.Size() || table[i].size > file.Size() - table[i].offset) {
+      file.Close();
+      return false;
+    }
+  }
+
+  // Same size and mtime is trusted, otherwise only a content hash match keeps the cache.
+  SourceStamp current;
+  if (!stat_source(source_path, false, current) || current.size != header.source.size) {
+    file.Close();
+    return false;
+  }
+  if (current.mtime != header.source.mtime) {
+    if (!stat_source(source_path, true, current) || current.hash != header.source.hash) {
+      file.Close();
+      return false;
+    }
+  }
+
+  chunks = table;
+  num_chunks = header.num_chunks;
+  return true;
+}
+
+const void* CacheReader::Find(uint32_t tag, uint32_t index, size_t* out_size) const {
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    if (chunks[i].tag == tag && chunks[i].index == index) {
+      if (out_size) {
+        *out_size = (size_t)chunks[i].size;
+      }
+      return file.Data() + chunks[i].offset;
+    }
+  }
+
+  if (out_size) {
+    *out_size = 0;
+  }
+  return nullptr;
+}
+
+MappedFile CacheReader::Release() {
+  chunks = nullptr;
+  num_chunks = 0;
+  return std::move(file);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Binary cache written next to a source asset as "<source>.bcache". The file is
+// a header, a chunk table and 64-byte aligned chunk payloads that are laid out
+// exactly as the runtime consumes them, so a mapped chunk can go straight to GL.
+
+constexpr uint32_t CacheVersion = 7;
+
+constexpr uint32_t cache_tag(char a, char b, char c, char d) {
+  return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+constexpr uint32_t CacheMagic = cache_tag('B', 'N', 'C', 'H');
+
+// Identity of the source file the cache was baked from.
+struct SourceStamp {
+  uint64_t size = 0;
+  int64_t mtime = 0;
+  uint64_t hash = 0;
+};
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  SourceStamp source;
+  uint32_t num_chunks;
+  uint32_t reserved;
+};
+
+struct CacheChunk {
+  uint32_t tag;
+  uint32_t index;
+  uint64_t offset;
+  uint64_t size;
+};
+
+std::string cache_path_for(const char* source_path);
+
+// Fills size and mtime, and the content hash when with_hash is set.
+bool stat_source(const char* path, bool with_hash, SourceStamp& out);
+
+class CacheWriter {
+public:
+  // The data must stay alive until Write() returns.
+  void Add(uint32_t tag, uint32_t index, const void* data, size_t size);
+
+  template <typename T>
+  void AddArray(uint32_t tag, uint32_t index, const std::vector<T>& values) {
+    Add(tag, index, values.data(), values.size() * sizeof(T));
+  }
+
+  bool Write(const char* path, const SourceStamp& source) const;
+
+private:
+  struct Pending {
+    uint32_t tag;
+    uint32_t index;
+    const void* data;
+    size_t size;
+  };
+
+  std::vector<Pending> chunks;
+};
+
+class CacheReader {
+public:
+  // Maps the cache and validates it against the source, fails when missing or stale.
+  bool Open(const char* cache_path, const char* source_path);
+
+  const void* Find(uint32_t tag, uint32_t index, size_t* out_size) const;
+
+  template <typename T>
+  const T* FindArray(uint32_t tag, uint32_t index, size_t* out_count) const {
+    size_t size = 0;
+    const T* data = (const T*)Find(tag, index, &size);
+    *out_count = data ? size / sizeof(T) : 0;
+    return data;
+  }
+
+  // Hands the mapping to the caller so pointers returned by Find() outlive the reader.
+  MappedFile Release();
+
+private:
+  MappedFile file;
+  const CacheChunk* chunks = nullptr;
+  uint32_t num_chunks = 0;
+};
@@ -7,14 +7,20 @@ Camera::Camera(int width, int heigth, glm::vec3 position) {
   Camera::width = width;
   Camera::height = heigth;
   Camera::position = position;
+}
 
-  //
+void Camera::Update(float FOV, float near_plane, float far_plane) {
+  view = glm::lookAt(position, position + orientation, up);
+  projection = glm::perspective(glm::radians(FOV), (float)width / (float)height, near_plane, far_plane);
 }
 
 void Camera::Matrix(float FOV, float near_plane, float far_plane, GLuint shaderProgram, const char* uniform) {
-  glm::mat4 view = glm::mat4(1.0f);
-  glm::mat4 projection = glm::mat4(1.0f);
+  Update(FOV, near_plane, far_plane);
+  glm::mat4 view_projection = projection * view;
+  glUniformMatrix4fv(glGetUniformLocation(shaderProgram, uniform), 1, GL_FALSE, glm::value_ptr(view_projection));
+}
 
-  view = glm::lookAt(position, position + orientation, up);
-  projection = glm::perspective(glm::radians(FOV), (float)(width / height), near_plane, far_plane);
+void Camera::BuildFrustum(Frustum& out) const {
+  glm::mat4 view_projection = projection * view;
+  frustum_from_matrix(glm::value_ptr(view_projection), out);
 }
@@ -3,6 +3,8 @@
 #include "glm/glm.hpp"
 #include <GL/glew.h>
 
+#include "culling.h"
+
 class Camera {
 public:
   Camera(int width, int heigth, glm::vec3 position);
@@ -14,5 +16,15 @@ public:
   int width;
   int height;
 
+  glm::mat4 view = glm::mat4(1.0f);
+  glm::mat4 projection = glm::mat4(1.0f);
+
+  // Recomputes view and projection from the position, orientation and size.
+  void Update(float FOV, float near_plane, float far_plane);
+
+  // Updates, then uploads projection * view to the uniform of shaderProgram.
   void Matrix(float FOV, float near_plane, float far_plane, GLuint shaderProgram, const char* uniform);
+
+  // World space frustum of the last Update().
+  void BuildFrustum(Frustum& out) const;
 };
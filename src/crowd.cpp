@@ -0,0 +1,396 @@
+#include "crowd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "allocators.h"
+#include "profiler.h"
+#include "shader.h"
+#include "simd.h"
+#include "skeleton.h"
+#include "thread_pool.h"
+
+namespace {
+
+constexpr int MaxGpuInfluences = 4;
+constexpr size_t AnimateBatch = 16;
+constexpr size_t BoneBytes = 16 * sizeof(float);
+
+// Clip bounds sample the clip this many times per key frame, and grow by the
+// margin for what moves between the samples.
+constexpr int ClipBoundsSamples = 2;
+constexpr float ClipBoundsMargin = 1.05f;
+
+using Clock = std::chrono::steady_clock;
+
+float max_axis_scale(const float* m) {
+  float scale = 0.0f;
+  for (int c = 0; c < 3; c++) {
+    scale = std::max(scale, m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+  }
+  return std::sqrt(scale);
+}
+
+struct SkinVertex {
+  uint16_t bones[MaxGpuInfluences];
+  float weights[MaxGpuInfluences];
+};
+
+} // namespace
+
+bool CrowdRenderer::Init(const ModelAsset& asset) {
+  model = &asset.data;
+
+  program = build_program(CrowdVertexShader, MeshFragmentShader);
+  if (!program) {
+    return false;
+  }
+  palette_offset_location = glGetUniformLocation(program, "paletteOffset");
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "tex0"), 0);
+  glUniform1i(glGetUniformLocation(program, "palettes"), 1);
+  glUseProgram(0);
+
+  skin_offsets.clear();
+  bones_per_instance = 1;
+  for (const SkinData& skin : model->skins) {
+    skin_offsets.push_back((uint32_t)bones_per_instance);
+    bones_per_instance += skin.NumBones();
+  }
+
+  // The palettes of every region of the stream ring must be addressable at once.
+  GLint max_texels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  max_instances = (size_t)max_texels / (bones_per_instance * 4) / StreamFrames;
+
+  triangles_per_instance = 0;
+  static_bounds = Aabb();
+  bounded_skins.clear();
+  bounds_clip = nullptr;
+  clip_bounds_valid = false;
+  meshes.resize(asset.meshes.size());
+  std::vector<SkinVertex> skin_vertices;
+  for (size_t i = 0; i < asset.meshes.size(); i++) {
+    const MeshView& view = asset.meshes[i];
+    CrowdMesh& mesh = meshes[i];
+
+    // Meshes without a skin follow the identity in slot 0 with a single full weight.
+    const SkinData* skin = view.skin >= 0 ? &model->skins[view.skin] : nullptr;
+    if (skin && skin->num_vertices != view.num_vertices) {
+      skin = nullptr;
+    }
+    skin_vertices.assign(view.num_vertices, SkinVertex{{0, 0, 0, 0}, {1.0f, 0.0f, 0.0f, 0.0f}});
+    if (skin) {
+      int influences = std::min(skin->max_influences, MaxGpuInfluences);
+      for (size_t v = 0; v < view.num_vertices; v++) {
+        for (int k = 0; k < influences; k++) {
+          skin_vertices[v].bones[k] = skin->bone_indices[k * skin->num_vertices + v];
+          skin_vertices[v].weights[k] = skin->bone_weights[k * skin->num_vertices + v];
+        }
+      }
+      mesh.palette_offset = (GLint)skin_offsets[view.skin];
+      if (std::find(bounded_skins.begin(), bounded_skins.end(), (uint32_t)view.skin) == bounded_skins.end()) {
+        bounded_skins.push_back((uint32_t)view.skin);
+      }
+    } else {
+      static_bounds.Add(view.bounds);
+    }
+
+    glGenVertexArrays(1, &mesh.vao);
+    glGenBuffers(1, &mesh.vbo);
+    glGenBuffers(1, &mesh.skin_vbo);
+    glGenBuffers(1, &mesh.ebo);
+
+    glBindVertexArray(mesh.vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, view.num_vertices * sizeof(Vertex), view.vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.skin_vbo);
+    glBufferData(GL_ARRAY_BUFFER, skin_vertices.size() * sizeof(SkinVertex), skin_vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribIPointer(3, 4, GL_UNSIGNED_SHORT, sizeof(SkinVertex), (void*)offsetof(SkinVertex, bones));
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(SkinVertex), (void*)offsetof(SkinVertex, weights));
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+
+    // Instance attributes advance once per instance, Draw() points them into the stream buffer.
+    for (GLuint location = 5; location <= 9; location++) {
+      glVertexAttribDivisor(location, 1);
+      glEnableVertexAttribArray(location);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, view.num_indices * view.index_size, view.indices, GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    mesh.index_count = (GLsizei)view.num_indices;
+    mesh.index_type = view.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    triangles_per_instance += view.num_indices / 3;
+  }
+
+  return true;
+}
+
+void CrowdRenderer::Destroy() {
+  for (CrowdMesh& mesh : meshes) {
+    glDeleteVertexArrays(1, &mesh.vao);
+    glDeleteBuffers(1, &mesh.vbo);
+    glDeleteBuffers(1, &mesh.skin_vbo);
+    glDeleteBuffers(1, &mesh.ebo);
+  }
+  meshes.clear();
+
+  glDeleteTextures(1, &palette_texture);
+  glDeleteProgram(program);
+  palette_texture = program = 0;
+}
+
+size_t CrowdRenderer::FrameBytes(size_t count) const {
+  return count * (sizeof(InstanceData) + bones_per_instance * BoneBytes) + BoneBytes;
+}
+
+bool CrowdRenderer::UseStream(const StreamBuffer& stream) {
+  GLint max_texels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+  if (stream.TotalSize() / BoneBytes * 4 > (size_t)max_texels) {
+    fprintf(stderr, "Stream buffer of %zu bytes exceeds GL_MAX_TEXTURE_BUFFER_SIZE\n", stream.TotalSize());
+    return false;
+  }
+  max_instances = std::min(max_instances, stream.FrameSize() / (sizeof(InstanceData) + bones_per_instance * BoneBytes));
+  cull_states.resize(max_instances);
+  poses.resize(max_instances);
+  for (Pose& pose : poses) {
+    pose.Resize(model->skeleton.NumJoints());
+  }
+
+  // The whole buffer is one texture buffer (glTexBufferRange needs GL 4.3),
+  // palettes are addressed by their offset in it.
+  stream_buffer = stream.Buffer();
+  if (!palette_texture) {
+    glGenTextures(1, &palette_texture);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, palette_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, stream_buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  for (CrowdMesh& mesh : meshes) {
+    mesh.instance_offset = -1;
+  }
+  return true;
+}
+
+void CrowdRenderer::UpdateClipBounds(const AnimClip* clip) {
+  if (clip_bounds_valid && bounds_clip == clip) {
+    return;
+  }
+
+  const Skeleton& skeleton = model->skeleton;
+  Pose pose;
+  std::vector<float> joint_to_model(skeleton.NumJoints() * 16);
+  Aabb bounds = static_bounds;
+  int samples = clip ? std::max((int)clip->num_frames, 1) * ClipBoundsSamples : 1;
+  for (int i = 0; i <= samples; i++) {
+    const float* model_matrices = skeleton.rest_model.data();
+    if (clip) {
+      sample_clip(*clip, clip->duration * (float)i / (float)samples, false, pose);
+      local_to_model(skeleton, pose, joint_to_model.data());
+      model_matrices = joint_to_model.data();
+    }
+    for (uint32_t s : bounded_skins) {
+      add_skin_bounds(model->skins[s], model_matrices, bounds);
+    }
+  }
+
+  float radius = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    clip_center[i] = bounds.Empty() ? 0.0f : (bounds.min[i] + bounds.max[i]) * 0.5f;
+    float extent = bounds.Empty() ? 0.0f : (bounds.max[i] - bounds.min[i]) * 0.5f;
+    radius += extent * extent;
+  }
+  clip_radius = std::sqrt(radius) * ClipBoundsMargin;
+  bounds_clip = clip;
+  clip_bounds_valid = true;
+}
+
+bool CrowdRenderer::Animate(const CrowdInstance* instances, size_t count, const AnimClip* clip, float time, ThreadPool* pool, StreamBuffer& stream,
+                            FrameArena& scratch, const Frustum* frustum, const OcclusionBuffer* occlusion) {
+  BONES_ZONE("crowd animate");
+  num_instances = 0;
+  cull_stats = CrowdCullStats();
+  count = std::min(count, max_instances);
+
+  GLintptr palette_offset = 0;
+  InstanceData* instance_data = (InstanceData*)stream.Allocate(count * sizeof(InstanceData), alignof(InstanceData), instance_offset);
+  float* palettes = (float*)stream.Allocate(count * bones_per_instance * BoneBytes, BoneBytes, palette_offset);
+  if (!instance_data || !palettes) {
+    fprintf(stderr, "Stream buffer too small for %zu crowd instances\n", count);
+    return false;
+  }
+  uint32_t first_bone = (uint32_t)(palette_offset / BoneBytes);
+
+  if (frustum) {
+    UpdateClipBounds(clip);
+  }
+  std::atomic<int64_t> cull_ns{0};
+
+  // Poses of AnimateBatch instances are sampled, then composed to model space in one batch.
+  // The posed instances of a batch use the pose slots of its first instances.
+  const Skeleton& skeleton = model->skeleton;
+  size_t model_stride = skeleton.NumJoints() * 16;
+  auto animate_range = [&](size_t begin, size_t end) {
+    BONES_ZONE("crowd animate range");
+    float* joint_to_model = clip ? scratch.Allocate<float>(AnimateBatch * model_stride) : nullptr;
+    CullBatch cull_batch;
+    uint8_t visible[AnimateBatch];
+    size_t posed[AnimateBatch];
+    Aabb boxes[AnimateBatch];
+
+    for (size_t batch = begin; batch < end; batch += AnimateBatch) {
+      size_t batch_count = std::min(AnimateBatch, end - batch);
+      size_t num_posed = 0;
+      Clock::time_point cull_start = Clock::now();
+      if (frustum) {
+        cull_batch.count = 0;
+        for (size_t i = batch; i < batch + batch_count; i++) {
+          const float* m = instances[i].transform;
+          float center[3];
+          for (int r = 0; r < 3; r++) {
+            center[r] = m[r] * clip_center[0] + m[4 + r] * clip_center[1] + m[8 + r] * clip_center[2] + m[12 + r];
+          }
+          cull_batch.AddSphere(center, clip_radius * max_axis_scale(m));
+        }
+        frustum_cull_spheres(*frustum, cull_batch, visible);
+        for (size_t k = 0; k < batch_count; k++) {
+          cull_states[batch + k] = visible[k] ? Visible : Outside;
+          if (visible[k]) {
+            posed[num_posed++] = batch + k;
+          }
+        }
+      } else {
+        for (size_t k = 0; k < batch_count; k++) {
+          cull_states[batch + k] = Visible;
+          posed[num_posed++] = batch + k;
+        }
+      }
+      int64_t batch_cull_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - cull_start).count();
+
+      if (clip && num_posed > 0) {
+        Pose* batch_poses = poses.data() + batch;
+        for (size_t k = 0; k < num_posed; k++) {
+          sample_clip(*clip, time + instances[posed[k]].time_offset, true, batch_poses[k]);
+        }
+        local_to_model_batch(skeleton, batch_poses, num_posed, nullptr, joint_to_model);
+      }
+
+      // The sphere covers the whole clip, the bone boxes only this pose.
+      if (frustum && num_posed > 0) {
+        cull_start = Clock::now();
+        cull_batch.count = 0;
+        for (size_t k = 0; k < num_posed; k++) {
+          const float* model_matrices = clip ? joint_to_model + k * model_stride : skeleton.rest_model.data();
+          Aabb bounds = static_bounds;
+          for (uint32_t s : bounded_skins) {
+            add_skin_bounds(model->skins[s], model_matrices, bounds);
+          }
+          boxes[k] = Aabb();
+          add_transformed_box(instances[posed[k]].transform, bounds, boxes[k]);
+          cull_batch.AddBox(boxes[k]);
+        }
+        frustum_cull_boxes(*frustum, cull_batch, visible);
+        for (size_t k = 0; k < num_posed; k++) {
+          if (!visible[k]) {
+            cull_states[posed[k]] = Outside;
+          } else if (occlusion && !occlusion->TestBox(boxes[k])) {
+            cull_states[posed[k]] = Occluded;
+          }
+        }
+        batch_cull_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - cull_start).count();
+      }
+      cull_ns.fetch_add(batch_cull_ns, std::memory_order_relaxed);
+
+      // Palettes are written in place, the stream region is what the GPU reads.
+      for (size_t k = 0; k < num_posed; k++) {
+        size_t i = posed[k];
+        if (cull_states[i] != Visible) {
+          continue;
+        }
+        const float* model_matrices = clip ? joint_to_model + k * model_stride : skeleton.rest_model.data();
+        float* palette = palettes + i * bones_per_instance * 16;
+        mat4_identity(palette);
+        for (size_t s = 0; s < model->skins.size(); s++) {
+          build_skin_palette(model->skins[s], model_matrices, palette + skin_offsets[s] * 16);
+        }
+      }
+    }
+  };
+
+  if (pool) {
+    pool->ParallelFor(count, AnimateBatch, animate_range);
+  } else {
+    animate_range(0, count);
+  }
+
+  // Instances that passed are packed to the front, each keeping its palette slot.
+  for (size_t i = 0; i < count; i++) {
+    if (cull_states[i] == Visible) {
+      InstanceData& data = instance_data[num_instances++];
+      memcpy(data.transform, instances[i].transform, sizeof(data.transform));
+      data.palette_base = first_bone + (uint32_t)(i * bones_per_instance);
+    } else if (cull_states[i] == Outside) {
+      cull_stats.outside++;
+    } else {
+      cull_stats.occluded++;
+    }
+  }
+  cull_stats.visible = num_instances;
+  cull_stats.cull_ms = (double)cull_ns.load() * 1e-6;
+  return true;
+}
+
+void CrowdRenderer::Draw(StreamBuffer& stream) {
+  BONES_ZONE("crowd draw");
+  stream.Flush();
+  if (num_instances == 0) {
+    return;
+  }
+
+  glUseProgram(program);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, palette_texture);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+  for (CrowdMesh& mesh : meshes) {
+    glBindVertexArray(mesh.vao);
+
+    // The region rotates every frame with a persistent ring, so the pointers follow it.
+    if (mesh.instance_offset != instance_offset) {
+      for (int c = 0; c < 4; c++) {
+        glVertexAttribPointer(5 + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(instance_offset + offsetof(InstanceData, transform) + c * 4 * sizeof(float)));
+      }
+      glVertexAttribIPointer(9, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)(instance_offset + offsetof(InstanceData, palette_base)));
+      mesh.instance_offset = instance_offset;
+    }
+
+    glUniform1i(palette_offset_location, mesh.palette_offset);
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.index_count, mesh.index_type, 0, (GLsizei)num_instances);
+    BONES_COUNT(ProfileCounter::DrawCalls, 1);
+    BONES_COUNT(ProfileCounter::Triangles, (size_t)mesh.index_count / 3 * num_instances);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
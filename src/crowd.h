@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "animation.h"
+#include "asset.h"
+#include "culling.h"
+#include "stream_buffer.h"
+
+class FrameArena;
+class ThreadPool;
+
+struct CrowdCullStats {
+  size_t visible = 0;
+  size_t outside = 0;   // culled by the frustum
+  size_t occluded = 0;  // in the frustum but behind the occluders
+  double cull_ms = 0.0; // bounds and tests, summed over threads
+};
+
+struct CrowdInstance {
+  float transform[16];
+  float time_offset = 0.0f; // seconds into the clip
+};
+
+// Draws many animated copies of a model with one glDrawElementsInstanced per mesh.
+// Instance transforms and the bone palettes of all instances are written straight
+// into the stream buffer, which is read as instanced vertex attributes and as a
+// texture buffer. The vertex shader skins.
+class CrowdRenderer {
+public:
+  bool Init(const ModelAsset& model);
+  void Destroy();
+
+  // Stream buffer space one frame of count instances needs.
+  size_t FrameBytes(size_t count) const;
+
+  // Reads palettes from stream, which Animate() must then always be given.
+  bool UseStream(const StreamBuffer& stream);
+
+  // Samples clip (rest pose when null) for every instance and builds their
+  // palettes in this frame's stream region on pool. With a frustum, instances
+  // whose sphere around every pose of the clip is outside are not posed at all,
+  // the rest are tested again with the boxes of their bones in the pose, then
+  // against occlusion when given. Only what passes gets a palette and is drawn.
+  // Model space matrices go to scratch, which must stay valid until the call returns.
+  bool Animate(const CrowdInstance* instances, size_t count, const AnimClip* clip, float time, ThreadPool* pool, StreamBuffer& stream,
+               FrameArena& scratch, const Frustum* frustum = nullptr, const OcclusionBuffer* occlusion = nullptr);
+
+  // Draws every mesh once, FrameData must be bound.
+  void Draw(StreamBuffer& stream);
+
+  size_t NumInstances() const { return num_instances; }
+  size_t MaxInstances() const { return max_instances; }
+  size_t DrawCalls() const { return meshes.size(); }
+  size_t BonesPerInstance() const { return bones_per_instance; }
+  size_t TrianglesPerInstance() const { return triangles_per_instance; }
+  const CrowdCullStats& CullStats() const { return cull_stats; }
+
+private:
+  void UpdateClipBounds(const AnimClip* clip);
+
+  struct InstanceData {
+    float transform[16];
+    uint32_t palette_base;
+  };
+
+  struct CrowdMesh {
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint skin_vbo = 0;
+    GLuint ebo = 0;
+    GLsizei index_count = 0;
+    GLenum index_type = GL_UNSIGNED_INT;
+    GLint palette_offset = 0;
+    GLintptr instance_offset = -1; // where the instance attributes point now
+  };
+
+  const ModelData* model = nullptr;
+  std::vector<CrowdMesh> meshes;
+
+  // Palette slot 0 of every instance is identity for meshes without a skin,
+  // skin s starts at skin_offsets[s].
+  std::vector<uint32_t> skin_offsets;
+  size_t bones_per_instance = 1;
+  size_t triangles_per_instance = 0;
+  size_t num_instances = 0;
+  size_t max_instances = 0;
+
+  // Model space bounds: meshes without a skin, and the skins to add posed bone boxes of.
+  Aabb static_bounds;
+  std::vector<uint32_t> bounded_skins;
+
+  // Sphere around every pose of bounds_clip, for the test before posing.
+  const AnimClip* bounds_clip = nullptr;
+  bool clip_bounds_valid = false;
+  float clip_center[3] = {};
+  float clip_radius = 0.0f;
+
+  enum CullState : uint8_t { Visible, Outside, Occluded };
+  std::vector<uint8_t> cull_states;
+  CrowdCullStats cull_stats;
+
+  // One per instance and sized for the skeleton up front, so sampling never allocates.
+  std::vector<Pose> poses;
+
+  GLintptr instance_offset = 0;
+
+  GLuint program = 0;
+  GLint palette_offset_location = -1;
+  GLuint stream_buffer = 0;
+  GLuint palette_texture = 0;
+};
@@ -0,0 +1,285 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+
+namespace {
+
+// Clip w below which a vertex counts as behind the eye.
+constexpr float MinClipW = 1e-5f;
+
+void transform_point(const float* m, float x, float y, float z, float* out) {
+  for (int r = 0; r < 4; r++) {
+    out[r] = m[r] * x + m[4 + r] * y + m[8 + r] * z + m[12 + r];
+  }
+}
+
+template <bool Spheres>
+size_t frustum_cull(const Frustum& frustum, const CullBatch& batch, uint8_t* visible) {
+  size_t num_visible = 0;
+  float abs_normals[6][3];
+  for (int p = 0; p < 6; p++) {
+    for (int i = 0; i < 3; i++) {
+      abs_normals[p][i] = std::fabs(frustum.planes[p][i]);
+    }
+  }
+
+#if defined(BONES_AVX2)
+  const __m256 zero = _mm256_setzero_ps();
+  for (size_t base = 0; base < batch.count; base += 8) {
+    __m256 cx = _mm256_load_ps(batch.center[0] + base);
+    __m256 cy = _mm256_load_ps(batch.center[1] + base);
+    __m256 cz = _mm256_load_ps(batch.center[2] + base);
+    __m256 ex = _mm256_load_ps(batch.extent[0] + base);
+    __m256 ey = _mm256_load_ps(batch.extent[1] + base);
+    __m256 ez = _mm256_load_ps(batch.extent[2] + base);
+
+    __m256 outside = zero;
+    for (int p = 0; p < 6; p++) {
+      const float* plane = frustum.planes[p];
+      __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(plane[0]), cx, _mm256_set1_ps(plane[3]));
+      distance = _mm256_fmadd_ps(_mm256_set1_ps(plane[1]), cy, distance);
+      distance = _mm256_fmadd_ps(_mm256_set1_ps(plane[2]), cz, distance);
+      __m256 radius = ex;
+      if (!Spheres) {
+        radius = _mm256_mul_ps(_mm256_set1_ps(abs_normals[p][0]), ex);
+        radius = _mm256_fmadd_ps(_mm256_set1_ps(abs_normals[p][1]), ey, radius);
+        radius = _mm256_fmadd_ps(_mm256_set1_ps(abs_normals[p][2]), ez, radius);
+      }
+      outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+    }
+
+    int mask = _mm256_movemask_ps(outside);
+    size_t lanes = std::min<size_t>(8, batch.count - base);
+    for (size_t l = 0; l < lanes; l++) {
+      visible[base + l] = (mask >> l & 1) == 0;
+      num_visible += visible[base + l];
+    }
+  }
+#elif defined(BONES_SSE)
+  const __m128 zero = _mm_setzero_ps();
+  for (size_t base = 0; base < batch.count; base += 4) {
+    __m128 cx = _mm_load_ps(batch.center[0] + base);
+    __m128 cy = _mm_load_ps(batch.center[1] + base);
+    __m128 cz = _mm_load_ps(batch.center[2] + base);
+    __m128 ex = _mm_load_ps(batch.extent[0] + base);
+    __m128 ey = _mm_load_ps(batch.extent[1] + base);
+    __m128 ez = _mm_load_ps(batch.extent[2] + base);
+
+    __m128 outside = zero;
+    for (int p = 0; p < 6; p++) {
+      const float* plane = frustum.planes[p];
+      __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), cx), _mm_set1_ps(plane[3]));
+      distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[1]), cy), distance);
+      distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), cz), distance);
+      __m128 radius = ex;
+      if (!Spheres) {
+        radius = _mm_mul_ps(_mm_set1_ps(abs_normals[p][0]), ex);
+        radius = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(abs_normals[p][1]), ey), radius);
+        radius = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(abs_normals[p][2]), ez), radius);
+      }
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+    }
+
+    int mask = _mm_movemask_ps(outside);
+    size_t lanes = std::min<size_t>(4, batch.count - base);
+    for (size_t l = 0; l < lanes; l++) {
+      visible[base + l] = (mask >> l & 1) == 0;
+      num_visible += visible[base + l];
+    }
+  }
+#else
+  for (size_t i = 0; i < batch.count; i++) {
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; p++) {
+      const float* plane = frustum.planes[p];
+      float distance = plane[0] * batch.center[0][i] + plane[1] * batch.center[1][i] + plane[2] * batch.center[2][i] + plane[3];
+      float radius = Spheres ? batch.extent[0][i]
+                             : abs_normals[p][0] * batch.extent[0][i] + abs_normals[p][1] * batch.extent[1][i] + abs_normals[p][2] * batch.extent[2][i];
+      outside = distance + radius < 0.0f;
+    }
+    visible[i] = !outside;
+    num_visible += visible[i];
+  }
+#endif
+
+  return num_visible;
+}
+
+} // namespace
+
+void add_transformed_box(const float* m, const float* center, const float* extent, Aabb& out) {
+  // Arvo: the new half extents are the old ones through the absolute matrix.
+  for (int r = 0; r < 3; r++) {
+    float c = m[r] * center[0] + m[4 + r] * center[1] + m[8 + r] * center[2] + m[12 + r];
+    float e = std::fabs(m[r]) * extent[0] + std::fabs(m[4 + r]) * extent[1] + std::fabs(m[8 + r]) * extent[2];
+    out.min[r] = std::min(out.min[r], c - e);
+    out.max[r] = std::max(out.max[r], c + e);
+  }
+}
+
+void add_transformed_box(const float* matrix, const Aabb& box, Aabb& out) {
+  if (box.Empty()) {
+    return;
+  }
+  float center[3];
+  float extent[3];
+  for (int i = 0; i < 3; i++) {
+    center[i] = (box.min[i] + box.max[i]) * 0.5f;
+    extent[i] = (box.max[i] - box.min[i]) * 0.5f;
+  }
+  add_transformed_box(matrix, center, extent, out);
+}
+
+void frustum_from_matrix(const float* m, Frustum& out) {
+  // Gribb-Hartmann, every plane is the last row plus or minus one of the others.
+  for (int p = 0; p < 6; p++) {
+    int row = p / 2;
+    float sign = p % 2 == 0 ? 1.0f : -1.0f;
+    float* plane = out.planes[p];
+    for (int c = 0; c < 4; c++) {
+      plane[c] = m[c * 4 + 3] + sign * m[c * 4 + row];
+    }
+    float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+    float inv = length > 0.0f ? 1.0f / length : 0.0f;
+    for (int c = 0; c < 4; c++) {
+      plane[c] *= inv;
+    }
+  }
+}
+
+size_t frustum_cull_boxes(const Frustum& frustum, const CullBatch& batch, uint8_t* visible) {
+  return frustum_cull<false>(frustum, batch, visible);
+}
+
+size_t frustum_cull_spheres(const Frustum& frustum, const CullBatch& batch, uint8_t* visible) {
+  return frustum_cull<true>(frustum, batch, visible);
+}
+
+bool OcclusionBuffer::Create(int buffer_width, int buffer_height) {
+  if (buffer_width <= 0 || buffer_height <= 0) {
+    return false;
+  }
+  width = buffer_width;
+  height = buffer_height;
+  depth.assign((size_t)width * height, 1.0f);
+  mat4_identity(view_projection);
+  return true;
+}
+
+void OcclusionBuffer::Clear(const float* matrix) {
+  std::fill(depth.begin(), depth.end(), 1.0f);
+  std::copy(matrix, matrix + 16, view_projection);
+}
+
+void OcclusionBuffer::RasterizeTriangles(const float* model, const float* positions, size_t stride,
+                                         const void* indices, size_t num_indices, uint32_t index_size) {
+  float mvp[16];
+  mat4_mul(view_projection, model, mvp);
+
+  for (size_t t = 0; t + 2 < num_indices; t += 3) {
+    // Screen x, y in pixels and depth in [0, 1] of the three corners.
+    float screen[3][3];
+    bool behind = false;
+    for (int k = 0; k < 3; k++) {
+      size_t index = index_size == 2 ? ((const uint16_t*)indices)[t + k] : ((const uint32_t*)indices)[t + k];
+      const float* p = positions + index * stride;
+      float clip[4];
+      transform_point(mvp, p[0], p[1], p[2], clip);
+      if (clip[3] < MinClipW) {
+        behind = true;
+        break;
+      }
+      float inv_w = 1.0f / clip[3];
+      screen[k][0] = (clip[0] * inv_w * 0.5f + 0.5f) * (float)width;
+      screen[k][1] = (clip[1] * inv_w * 0.5f + 0.5f) * (float)height;
+      screen[k][2] = clip[2] * inv_w * 0.5f + 0.5f;
+    }
+    if (behind) {
+      continue;
+    }
+
+    float area = (screen[1][0] - screen[0][0]) * (screen[2][1] - screen[0][1]) -
+                 (screen[2][0] - screen[0][0]) * (screen[1][1] - screen[0][1]);
+    if (std::fabs(area) < 1e-8f) {
+      continue;
+    }
+
+    // Pixel centers inside the triangle, either winding.
+    int x0 = std::max((int)std::ceil(std::min({screen[0][0], screen[1][0], screen[2][0]}) - 0.5f), 0);
+    int x1 = std::min((int)std::floor(std::max({screen[0][0], screen[1][0], screen[2][0]}) - 0.5f), width - 1);
+    int y0 = std::max((int)std::ceil(std::min({screen[0][1], screen[1][1], screen[2][1]}) - 0.5f), 0);
+    int y1 = std::min((int)std::floor(std::max({screen[0][1], screen[1][1], screen[2][1]}) - 0.5f), height - 1);
+
+    float inv_area = 1.0f / area;
+    for (int y = y0; y <= y1; y++) {
+      float py = (float)y + 0.5f;
+      float* row = depth.data() + (size_t)y * width;
+      for (int x = x0; x <= x1; x++) {
+        float px = (float)x + 0.5f;
+        float w0 = ((screen[2][0] - screen[1][0]) * (py - screen[1][1]) - (screen[2][1] - screen[1][1]) * (px - screen[1][0])) * inv_area;
+        float w1 = ((screen[0][0] - screen[2][0]) * (py - screen[2][1]) - (screen[0][1] - screen[2][1]) * (px - screen[2][0])) * inv_area;
+        float w2 = 1.0f - w0 - w1;
+        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+          continue;
+        }
+        float z = w0 * screen[0][2] + w1 * screen[1][2] + w2 * screen[2][2];
+        row[x] = std::min(row[x], z);
+      }
+    }
+  }
+}
+
+bool OcclusionBuffer::TestBox(const Aabb& box) const {
+  float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+  float min_z = FLT_MAX;
+  for (int corner = 0; corner < 8; corner++) {
+    float clip[4];
+    transform_point(view_projection,
+        corner & 1 ? box.max[0] : box.min[0],
+        corner & 2 ? box.max[1] : box.min[1],
+        corner & 4 ? box.max[2] : box.min[2],
+        clip);
+    if (clip[3] < MinClipW) {
+      return true;
+    }
+    float inv_w = 1.0f / clip[3];
+    float x = (clip[0] * inv_w * 0.5f + 0.5f) * (float)width;
+    float y = (clip[1] * inv_w * 0.5f + 0.5f) * (float)height;
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y);
+    max_y = std::max(max_y, y);
+    min_z = std::min(min_z, clip[2] * inv_w * 0.5f + 0.5f);
+  }
+
+  // Every pixel the rectangle touches, visible as soon as one has nothing nearer than the box.
+  int x0 = std::max((int)std::floor(min_x), 0);
+  int x1 = std::min((int)std::floor(max_x), width - 1);
+  int y0 = std::max((int)std::floor(min_y), 0);
+  int y1 = std::min((int)std::floor(max_y), height - 1);
+  if (x0 > x1 || y0 > y1) {
+    return false;
+  }
+
+  for (int y = y0; y <= y1; y++) {
+    const float* row = depth.data() + (size_t)y * width;
+    int x = x0;
+#if defined(BONES_SSE)
+    __m128 nearest = _mm_set1_ps(min_z);
+    for (; x + 3 <= x1; x += 4) {
+      if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), nearest)) != 0) {
+        return true;
+      }
+    }
+#endif
+    for (; x <= x1; x++) {
+      if (row[x] >= min_z) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
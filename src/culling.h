@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Axis aligned box, empty until something is added to it.
+struct Aabb {
+  float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+  float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+  bool Empty() const { return min[0] > max[0]; }
+
+  void Add(const float* point) {
+    for (int i = 0; i < 3; i++) {
+      min[i] = point[i] < min[i] ? point[i] : min[i];
+      max[i] = point[i] > max[i] ? point[i] : max[i];
+    }
+  }
+
+  void Add(const Aabb& box) {
+    for (int i = 0; i < 3; i++) {
+      min[i] = box.min[i] < min[i] ? box.min[i] : min[i];
+      max[i] = box.max[i] > max[i] ? box.max[i] : max[i];
+    }
+  }
+};
+
+// Adds the box around center +- extent moved by the affine column-major matrix to out.
+void add_transformed_box(const float* matrix, const float* center, const float* extent, Aabb& out);
+void add_transformed_box(const float* matrix, const Aabb& box, Aabb& out);
+
+// Planes a x + b y + c z + d >= 0 inside, normalized, left/right/bottom/top/near/far.
+struct Frustum {
+  float planes[6][4];
+};
+
+// Extracts the planes of a column-major view * projection (or model * view * projection) matrix.
+void frustum_from_matrix(const float* view_projection, Frustum& out);
+
+constexpr size_t CullBatchSize = 16;
+
+// Up to CullBatchSize volumes as SoA streams, so the tests run 8 (AVX2) or 4
+// (SSE) of them per plane at once. Spheres keep their radius in extent[0].
+struct CullBatch {
+  alignas(32) float center[3][CullBatchSize] = {};
+  alignas(32) float extent[3][CullBatchSize] = {};
+  size_t count = 0;
+
+  void AddBox(const Aabb& box) {
+    for (int i = 0; i < 3; i++) {
+      center[i][count] = (box.min[i] + box.max[i]) * 0.5f;
+      extent[i][count] = (box.max[i] - box.min[i]) * 0.5f;
+    }
+    count++;
+  }
+
+  void AddSphere(const float* position, float radius) {
+    for (int i = 0; i < 3; i++) {
+      center[i][count] = position[i];
+    }
+    extent[0][count] = radius;
+    count++;
+  }
+};
+
+// Sets visible[i] to 1 for the volumes of the batch that intersect the frustum
+// and to 0 for the rest, returns how many are visible.
+size_t frustum_cull_boxes(const Frustum& frustum, const CullBatch& batch, uint8_t* visible);
+size_t frustum_cull_spheres(const Frustum& frustum, const CullBatch& batch, uint8_t* visible);
+
+// Low resolution depth buffer the CPU rasterizes a few large occluders into,
+// so that whatever is entirely behind them never reaches the GPU. Occluders
+// cover every pixel whose center they cover, so a sliver of an object seen past
+// the edge of one can be culled at this resolution. Tests are read-only and may
+// run on any thread once the occluders are in.
+class OcclusionBuffer {
+public:
+  bool Create(int width, int height);
+
+  // Clears to the far plane and takes the view * projection of this frame.
+  void Clear(const float* view_projection);
+
+  // Rasterizes indexed triangles moved by model, positions are xyz with a stride in floats.
+  // Triangles crossing the eye plane are skipped rather than clipped.
+  void RasterizeTriangles(const float* model, const float* positions, size_t stride,
+                          const void* indices, size_t num_indices, uint32_t index_size);
+
+  // False when every pixel the world space box covers has an occluder in front of it.
+  bool TestBox(const Aabb& box) const;
+
+  int Width() const { return width; }
+  int Height() const { return height; }
+  const float* Depth() const { return depth.data(); } // rows bottom up, 0 near to 1 far
+
+private:
+  int width = 0;
+  int height = 0;
+  std::vector<float> depth;
+  float view_projection[16] = {};
+};
@@ -0,0 +1,103 @@
+#include "fbx_thread_pool.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "thread_pool.h"
+
+namespace {
+
+// Per-load state, ufbx may run several loads on the same pool at once. Shared
+// with the submitted helpers, which can start after the load has finished.
+struct LoadTasks {
+  ThreadPool* pool;
+  ufbx_thread_pool_context ctx;
+  std::mutex mutex;
+  std::deque<uint32_t> queued[UFBX_THREAD_GROUP_COUNT];
+  std::atomic<uint32_t> pending[UFBX_THREAD_GROUP_COUNT];
+
+  // Runs one queued task of group, or of any group when group is negative.
+  bool RunOne(int group) {
+    uint32_t index = 0;
+    int task_group = -1;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int g = 0; g < UFBX_THREAD_GROUP_COUNT && task_group < 0; g++) {
+        if ((group < 0 || g == group) && !queued[g].empty()) {
+          index = queued[g].front();
+          queued[g].pop_front();
+          task_group = g;
+        }
+      }
+    }
+    if (task_group < 0) {
+      return false;
+    }
+
+    ufbx_thread_pool_run_task(ctx, index);
+    pending[task_group].fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+};
+
+using LoadTasksPtr = std::shared_ptr<LoadTasks>;
+
+LoadTasks& get_tasks(ufbx_thread_pool_context ctx) {
+  return **(LoadTasksPtr*)ufbx_thread_pool_get_user_ptr(ctx);
+}
+
+bool pool_init(void* user, ufbx_thread_pool_context ctx, const ufbx_thread_pool_info*) {
+  LoadTasksPtr tasks = std::make_shared<LoadTasks>();
+  tasks->pool = (ThreadPool*)user;
+  tasks->ctx = ctx;
+  for (std::atomic<uint32_t>& pending : tasks->pending) {
+    pending.store(0, std::memory_order_relaxed);
+  }
+  ufbx_thread_pool_set_user_ptr(ctx, new LoadTasksPtr(std::move(tasks)));
+  return true;
+}
+
+void pool_run(void*, ufbx_thread_pool_context ctx, uint32_t group, uint32_t start_index, uint32_t count) {
+  LoadTasksPtr tasks = *(LoadTasksPtr*)ufbx_thread_pool_get_user_ptr(ctx);
+  tasks->pending[group].fetch_add(count, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(tasks->mutex);
+    for (uint32_t i = 0; i < count; i++) {
+      tasks->queued[group].push_back(start_index + i);
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    tasks->pool->Submit([tasks] { tasks->RunOne(-1); });
+  }
+}
+
+// Only helps with this load's own tasks, picking up unrelated pool work here
+// would nest whole asset loads inside the parse.
+void pool_wait(void*, ufbx_thread_pool_context ctx, uint32_t group, uint32_t) {
+  LoadTasks& tasks = get_tasks(ctx);
+  while (tasks.pending[group].load(std::memory_order_acquire) > 0) {
+    if (!tasks.RunOne((int)group)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void pool_free(void*, ufbx_thread_pool_context ctx) {
+  delete (LoadTasksPtr*)ufbx_thread_pool_get_user_ptr(ctx);
+}
+
+} // namespace
+
+ufbx_thread_pool make_fbx_thread_pool(ThreadPool& pool) {
+  ufbx_thread_pool result = {};
+  result.init_fn = pool_init;
+  result.run_fn = pool_run;
+  result.wait_fn = pool_wait;
+  result.free_fn = pool_free;
+  result.user = &pool;
+  return result;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "ufbx.h"
+
+class ThreadPool;
+
+// Lets ufbx run its parse tasks on pool. The waiting thread runs its own queued
+// tasks too, so a load running on one of the pool's workers cannot deadlock.
+ufbx_thread_pool make_fbx_thread_pool(ThreadPool& pool);
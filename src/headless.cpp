@@ -0,0 +1,1385 @@
+#include "headless.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "allocators.h"
+#include "animation.h"
+#include "asset.h"
+#include "camera.h"
+#include "crowd.h"
+#include "culling.h"
+#include "profiler.h"
+#include "shader.h"
+#include "skeleton.h"
+#include "skinning.h"
+#include "stream_buffer.h"
+#include "texture_streamer.h"
+#include "thread_pool.h"
+
+#if defined(BONES_HEADLESS)
+  #define EGL_NO_X11
+  #include <EGL/egl.h>
+  #include <EGL/eglext.h>
+#endif
+
+bool parse_headless_args(int argc, char** argv, HeadlessOptions& out) {
+  for (int i = 0; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = true;
+
+    if (arg[0] != '-') {
+      out.model_path = arg;
+      continue;
+    } else if (!value) {
+      ok = false;
+    } else if (strcmp(arg, "--frames") == 0) {
+      out.frames = atoi(value);
+      ok = out.frames > 0;
+    } else if (strcmp(arg, "--warmup") == 0) {
+      out.warmup_frames = atoi(value);
+      ok = out.warmup_frames >= 0;
+    } else if (strcmp(arg, "--size") == 0) {
+      ok = sscanf(value, "%dx%d", &out.width, &out.height) == 2 && out.width > 0 && out.height > 0;
+    } else if (strcmp(arg, "--clip") == 0) {
+      out.clip = atoi(value);
+    } else if (strcmp(arg, "--texture") == 0) {
+      out.texture_path = value;
+    } else if (strcmp(arg, "--dump") == 0) {
+      out.dump_dir = value;
+    } else if (strcmp(arg, "--dump-every") == 0) {
+      out.dump_every = atoi(value);
+      ok = out.dump_every > 0;
+    } else if (strcmp(arg, "--report") == 0) {
+      out.report_path = value;
+    } else if (strcmp(arg, "--instances") == 0) {
+      out.max_instances = atoi(value);
+      ok = out.max_instances > 0;
+    } else if (strcmp(arg, "--streaming") == 0) {
+      out.persistent_streaming = strcmp(value, "persistent") == 0;
+      ok = out.persistent_streaming || strcmp(value, "orphan") == 0;
+    } else if (strcmp(arg, "--textures") == 0) {
+      out.num_textures = atoi(value);
+      ok = out.num_textures > 0;
+    } else if (strcmp(arg, "--budget") == 0) {
+      out.texture_budget_mb = atoi(value);
+      ok = out.texture_budget_mb > 0;
+    } else if (strcmp(arg, "--culling") == 0) {
+      if (strcmp(value, "off") == 0) {
+        out.culling = CullMode::Off;
+      } else if (strcmp(value, "frustum") == 0) {
+        out.culling = CullMode::Frustum;
+      } else {
+        out.culling = CullMode::Occlusion;
+        ok = strcmp(value, "occlusion") == 0;
+      }
+    } else if (strcmp(arg, "--trace") == 0) {
+      out.trace_path = value;
+#if !defined(BONES_PROFILER)
+      fprintf(stderr, "--trace needs a build with BONES_PROFILER\n");
+      ok = false;
+#endif
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      fprintf(stderr, "Invalid headless argument: %s %s\n", arg, value ? value : "");
+      return false;
+    }
+    i++;
+  }
+  return true;
+}
+
+#if defined(BONES_HEADLESS)
+
+namespace {
+
+constexpr float FrameRate = 60.0f;
+constexpr float RotationSpeed = 15.0f; // degrees per second, matches the window loop
+
+constexpr int TimerQueries = 4;
+constexpr size_t UniformFrameBytes = 4096;
+constexpr int OcclusionScale = 4; // occlusion buffer pixels per side of the framebuffer's
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+class EglContext {
+public:
+  ~EglContext();
+
+  bool Create();
+
+private:
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLContext context = EGL_NO_CONTEXT;
+  EGLSurface surface = EGL_NO_SURFACE;
+};
+
+EglContext::~EglContext() {
+  if (display == EGL_NO_DISPLAY) {
+    return;
+  }
+
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (surface != EGL_NO_SURFACE) {
+    eglDestroySurface(display, surface);
+  }
+  if (context != EGL_NO_CONTEXT) {
+    eglDestroyContext(display, context);
+  }
+  eglTerminate(display);
+}
+
+bool EglContext::Create() {
+  // The surfaceless platform needs neither X11 nor a DRM device, so it runs on GPU-less CI boxes.
+#if defined(EGL_PLATFORM_SURFACELESS_MESA)
+  auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (get_platform_display) {
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+  }
+#endif
+  if (display == EGL_NO_DISPLAY) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  EGLint major = 0;
+  EGLint minor = 0;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    fprintf(stderr, "Failed to initialize EGL\n");
+    display = EGL_NO_DISPLAY;
+    return false;
+  }
+
+  const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint num_configs = 0;
+  if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+    fprintf(stderr, "No EGL config with desktop OpenGL support\n");
+    return false;
+  }
+
+  const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  eglBindAPI(EGL_OPENGL_API);
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+  if (context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "Failed to create an OpenGL 3.3 core context: 0x%x\n", eglGetError());
+    return false;
+  }
+
+  // Everything renders into an FBO, the pbuffer only exists for drivers without surfaceless contexts.
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+    if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context)) {
+      fprintf(stderr, "Failed to make the EGL context current: 0x%x\n", eglGetError());
+      return false;
+    }
+  }
+
+  glewExperimental = GL_TRUE;
+  GLenum status = glewInit();
+#if defined(GLEW_ERROR_NO_GLX_DISPLAY)
+  // GLEW built for GLX loads the GL entry points fine, then complains that there is no X display.
+  if (status == GLEW_ERROR_NO_GLX_DISPLAY) {
+    status = GLEW_OK;
+  }
+#endif
+  if (status != GLEW_OK) {
+    fprintf(stderr, "Failed to initialize GLEW!\n");
+    return false;
+  }
+
+  printf("EGL %d.%d, %s, %s\n", major, minor, glGetString(GL_VERSION), glGetString(GL_RENDERER));
+  return true;
+}
+
+struct Framebuffer {
+  GLuint fbo = 0;
+  GLuint color = 0;
+  GLuint depth = 0;
+
+  bool Create(int width, int height);
+  void Destroy();
+};
+
+bool Framebuffer::Create(int width, int height) {
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(1, &color);
+  glGenRenderbuffers(1, &depth);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "Framebuffer %dx%d is incomplete: 0x%x\n", width, height, status);
+    return false;
+  }
+  return true;
+}
+
+void Framebuffer::Destroy() {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &color);
+  glDeleteRenderbuffers(1, &depth);
+  fbo = color = depth = 0;
+}
+
+struct FrameStats {
+  double mean = 0.0;
+  double p50 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+};
+
+FrameStats compute_stats(std::vector<double> samples) {
+  FrameStats stats;
+  if (samples.empty()) {
+    return stats;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  for (double sample : samples) {
+    stats.mean += sample;
+  }
+  stats.mean /= (double)samples.size();
+
+  // Nearest rank percentiles.
+  auto percentile = [&](double p) {
+    size_t rank = (size_t)std::ceil(p * (double)samples.size());
+    return samples[std::min(std::max<size_t>(rank, 1), samples.size()) - 1];
+  };
+  stats.p50 = percentile(0.50);
+  stats.p99 = percentile(0.99);
+  stats.max = samples.back();
+  return stats;
+}
+
+// Binary PPM, rows flipped since GL reads the framebuffer bottom-up.
+bool write_ppm(const std::string& path, int width, int height, const uint8_t* rgba) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to write %s\n", path.c_str());
+    return false;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  std::vector<uint8_t> row((size_t)width * 3);
+  for (int y = height - 1; y >= 0; y--) {
+    const uint8_t* src = rgba + (size_t)y * width * 4;
+    for (int x = 0; x < width; x++) {
+      row[x * 3 + 0] = src[x * 4 + 0];
+      row[x * 3 + 1] = src[x * 4 + 1];
+      row[x * 3 + 2] = src[x * 4 + 2];
+    }
+    fwrite(row.data(), 1, row.size(), file);
+  }
+
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  return ok;
+}
+
+std::string json_string(const char* text) {
+  std::string out = "\"";
+  for (const char* c = text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      out += '\\';
+    }
+    out += (unsigned char)*c < 0x20 ? ' ' : *c;
+  }
+  return out + "\"";
+}
+
+std::string json_stats(const FrameStats& stats) {
+  char text[128];
+  snprintf(text, sizeof(text), "{\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+      stats.mean, stats.p50, stats.p99, stats.max);
+  return text;
+}
+
+// Writes view and projection into this frame's region and binds them as FrameData.
+void stream_frame_uniforms(StreamBuffer& stream, const glm::mat4& view, const glm::mat4& projection) {
+  GLintptr offset = 0;
+  FrameUniforms* frame = stream.Allocate<FrameUniforms>(offset);
+  if (!frame) {
+    return;
+  }
+  memcpy(frame->view, glm::value_ptr(view), sizeof(frame->view));
+  memcpy(frame->projection, glm::value_ptr(projection), sizeof(frame->projection));
+  glBindBufferRange(GL_UNIFORM_BUFFER, FrameBlockBinding, stream.Buffer(), offset, sizeof(FrameUniforms));
+}
+
+void print_stream_stats(const StreamBuffer& stream, int frames) {
+  const StreamStats& stats = stream.Stats();
+  printf("streaming: %s, %.1f KB/frame, %.2f MB uploaded, %llu fence stalls (%.3f ms)\n",
+      stream.Persistent() ? "persistent mapped ring" : "orphan + glBufferSubData",
+      (double)stats.bytes_uploaded / 1024.0 / (double)std::max(frames, 1),
+      (double)stats.bytes_uploaded / (1024.0 * 1024.0),
+      (unsigned long long)stats.fence_stalls,
+      stats.stall_ms);
+}
+
+std::string json_stream(const StreamBuffer& stream) {
+  const StreamStats& stats = stream.Stats();
+  char text[160];
+  snprintf(text, sizeof(text), "{\"persistent\": %s, \"bytes_uploaded\": %llu, \"fence_stalls\": %llu, \"stall_ms\": %.4f}",
+      stream.Persistent() ? "true" : "false",
+      (unsigned long long)stats.bytes_uploaded,
+      (unsigned long long)stats.fence_stalls,
+      stats.stall_ms);
+  return text;
+}
+
+// Ends every frame for the profiler, sums its counters over the measured frames
+// and, with a trace path, captures the measured frames of the traced run.
+class FrameProfile {
+public:
+  FrameProfile(const HeadlessOptions& options, bool traced) : trace_path(traced ? options.trace_path : nullptr) {}
+
+  void BeginFrame(bool measured) {
+    if (trace_path && measured && !profiler_capturing()) {
+      profiler_begin_capture();
+    }
+  }
+
+  void EndFrame(bool measured) {
+    profiler_frame();
+    if (measured) {
+      const ProfileCounters& counters = profiler_frame_counters();
+      for (int i = 0; i < (int)ProfileCounter::Count; i++) {
+        totals.values[i] += counters.values[i];
+      }
+      frames++;
+    }
+  }
+
+  bool Finish() {
+    return !trace_path || !profiler_capturing() || profiler_end_capture(trace_path);
+  }
+
+  double PerFrame(ProfileCounter counter) const {
+    return frames > 0 ? (double)totals[counter] / (double)frames : 0.0;
+  }
+
+private:
+  const char* trace_path;
+  ProfileCounters totals;
+  int frames = 0;
+};
+
+void print_frame_profile(const FrameProfile& profile) {
+#if defined(BONES_PROFILER)
+  printf("per frame: %.1f draw calls, %.0f triangles, %.1f KB uploaded, %.1f allocations\n",
+      profile.PerFrame(ProfileCounter::DrawCalls),
+      profile.PerFrame(ProfileCounter::Triangles),
+      profile.PerFrame(ProfileCounter::BytesUploaded) / 1024.0,
+      profile.PerFrame(ProfileCounter::Allocations));
+#else
+  (void)profile;
+#endif
+}
+
+// GL_TIME_ELAPSED per frame, read back TimerQueries frames late so the queries
+// never stall the pipeline, which also bounds how far the CPU runs ahead.
+class GpuTimer {
+public:
+  void Create();
+  void Destroy();
+
+  // Frames begun with measured = false are timed but not recorded.
+  void Begin(bool measured);
+  void End();
+
+  // Reads back every query still in flight, call after glFinish().
+  void Finish();
+
+  std::vector<double> samples_ms;
+
+private:
+  void Read(int slot);
+
+  GLuint queries[TimerQueries] = {};
+  bool pending[TimerQueries] = {};
+  bool recorded[TimerQueries] = {};
+  int slot = 0;
+};
+
+void GpuTimer::Create() {
+  glGenQueries(TimerQueries, queries);
+}
+
+void GpuTimer::Destroy() {
+  glDeleteQueries(TimerQueries, queries);
+}
+
+void GpuTimer::Begin(bool measured) {
+  slot = (slot + 1) % TimerQueries;
+  if (pending[slot]) {
+    Read(slot);
+  }
+  glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+  pending[slot] = true;
+  recorded[slot] = measured;
+}
+
+void GpuTimer::End() {
+  glEndQuery(GL_TIME_ELAPSED);
+}
+
+void GpuTimer::Finish() {
+  for (int i = 1; i <= TimerQueries; i++) {
+    int oldest = (slot + i) % TimerQueries;
+    if (pending[oldest]) {
+      Read(oldest);
+    }
+  }
+}
+
+void GpuTimer::Read(int index) {
+  GLuint64 elapsed_ns = 0;
+  glGetQueryObjectui64v(queries[index], GL_QUERY_RESULT, &elapsed_ns);
+  if (recorded[index]) {
+    samples_ms.push_back((double)elapsed_ns * 1e-6);
+  }
+  pending[index] = false;
+}
+
+// A missing texture only changes the pixels, not the work, so it falls back to white.
+GLuint load_diffuse_texture(const char* path) {
+  const uint8_t white[4] = {255, 255, 255, 255};
+  TextureAsset asset;
+  if (!load_texture(path, asset)) {
+    asset = TextureAsset();
+    asset.width = 1;
+    asset.height = 1;
+    asset.num_mips = 1;
+    asset.mips[0] = white;
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  upload_texture(texture, asset);
+  return texture;
+}
+
+// Bounding sphere of the bind pose vertices of every mesh.
+void model_bounds(const ModelAsset& model, glm::vec3& center, float& radius) {
+  glm::vec3 bounds_min(FLT_MAX);
+  glm::vec3 bounds_max(-FLT_MAX);
+  for (const MeshView& view : model.meshes) {
+    for (size_t v = 0; v < view.num_vertices; v++) {
+      const float* p = view.vertices[v].position;
+      bounds_min = glm::min(bounds_min, glm::vec3(p[0], p[1], p[2]));
+      bounds_max = glm::max(bounds_max, glm::vec3(p[0], p[1], p[2]));
+    }
+  }
+  center = (bounds_min + bounds_max) * 0.5f;
+  radius = std::max(glm::length(bounds_max - bounds_min) * 0.5f, 1e-3f);
+}
+
+const AnimClip* find_clip(const ModelAsset& model, int index) {
+  if (index >= 0 && (size_t)index < model.data.clips.size()) {
+    return &model.data.clips[index];
+  }
+  return nullptr;
+}
+
+const char* cull_mode_name(CullMode mode) {
+  switch (mode) {
+    case CullMode::Off: return "off";
+    case CullMode::Frustum: return "frustum";
+    case CullMode::Occlusion: return "occlusion";
+  }
+  return "";
+}
+
+// Axis aligned box of 24 vertices, so every face has its own normal and UVs.
+void append_box(const glm::vec3& center, const glm::vec3& half, std::vector<Vertex>& vertices, std::vector<uint16_t>& indices) {
+  const uint16_t quad[6] = {0, 1, 2, 0, 2, 3};
+  for (int axis = 0; axis < 3; axis++) {
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    for (float side : {-1.0f, 1.0f}) {
+      uint16_t base = (uint16_t)vertices.size();
+      for (int corner = 0; corner < 4; corner++) {
+        float su = corner == 1 || corner == 2 ? 1.0f : -1.0f;
+        float sv = corner >= 2 ? 1.0f : -1.0f;
+        glm::vec3 p = center;
+        p[axis] += side * half[axis];
+        p[u] += su * half[u];
+        p[v] += sv * half[v];
+        glm::vec3 normal(0.0f);
+        normal[axis] = side;
+        vertices.push_back({{p[0], p[1], p[2]}, {normal[0], normal[1], normal[2]}, {su * 0.5f + 0.5f, sv * 0.5f + 0.5f}});
+      }
+      for (uint16_t index : quad) {
+        indices.push_back(base + index);
+      }
+    }
+  }
+}
+
+// A mesh that is skinned on the CPU every frame and streamed back into its vertex buffer.
+struct SkinnedMesh {
+  size_t mesh;
+  const SkinData* skin;
+  std::vector<float> palette;
+  std::vector<float> positions;
+  std::vector<float> normals;
+  std::vector<Vertex> vertices;
+};
+
+} // namespace
+
+int run_headless_benchmark(const HeadlessOptions& options) {
+  EglContext egl;
+  if (!egl.Create()) {
+    return 1;
+  }
+
+  ThreadPool pool;
+  ModelAsset model;
+  if (!load_model(options.model_path, model, &pool)) {
+    return 1;
+  }
+
+  Framebuffer framebuffer;
+  if (!framebuffer.Create(options.width, options.height)) {
+    return 1;
+  }
+
+  GLuint program = build_program(MeshVertexShader, MeshFragmentShader);
+  if (!program) {
+    return 1;
+  }
+  GLint tex0_location = glGetUniformLocation(program, "tex0");
+
+  StreamBuffer stream;
+  if (!stream.Create(UniformFrameBytes, options.persistent_streaming)) {
+    return 1;
+  }
+
+  const AnimClip* clip = find_clip(model, options.clip);
+
+  std::vector<GpuMesh> gpu_meshes(model.meshes.size());
+  std::vector<SkinnedMesh> skinned;
+  size_t triangles = 0;
+
+  for (size_t i = 0; i < model.meshes.size(); i++) {
+    const MeshView& view = model.meshes[i];
+    // A skin for a different vertex count would overrun the buffers, that mesh stays static.
+    bool animated = clip && view.skin >= 0 && model.data.skins[view.skin].num_vertices == view.num_vertices;
+    gpu_meshes[i].Upload(view, animated ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    triangles += view.num_indices / 3;
+
+    if (animated) {
+      SkinnedMesh mesh;
+      mesh.mesh = i;
+      mesh.skin = &model.data.skins[view.skin];
+      mesh.palette.resize(mesh.skin->NumBones() * 16);
+      mesh.positions.resize(view.num_vertices * 3);
+      mesh.normals.resize(view.num_vertices * 3);
+      mesh.vertices.assign(view.vertices, view.vertices + view.num_vertices);
+      skinned.push_back(std::move(mesh));
+    }
+  }
+
+  if (triangles == 0) {
+    fprintf(stderr, "Nothing to render in %s\n", options.model_path);
+    return 1;
+  }
+
+  GLuint texture = load_diffuse_texture(options.texture_path);
+
+  // Frame the bind pose bounds from slightly above.
+  glm::vec3 center;
+  float radius;
+  model_bounds(model, center, radius);
+  glm::mat4 view_mat = glm::lookAt(center + glm::vec3(0.0f, radius * 0.5f, radius * 3.0f), center, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection_mat = glm::perspective(
+      glm::radians(45.0f),
+      (float)options.width / (float)options.height,
+      radius * 0.05f,
+      radius * 10.0f);
+
+  glViewport(0, 0, options.width, options.height);
+  glEnable(GL_DEPTH_TEST);
+  glUseProgram(program);
+  glUniform1i(tex0_location, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  GpuTimer gpu_timer;
+  gpu_timer.Create();
+  gpu_timer.samples_ms.reserve(options.frames);
+  profiler_create_gpu();
+  FrameProfile profile(options, true);
+
+  Pose pose;
+  std::vector<float> joint_to_model(model.data.skeleton.NumJoints() * 16);
+  std::vector<uint8_t> pixels;
+
+  int total_frames = options.warmup_frames + options.frames;
+  std::vector<double> cpu_ms;
+  std::vector<double> frame_ms;
+  cpu_ms.reserve(options.frames);
+  frame_ms.reserve(options.frames);
+
+  printf("headless benchmark: %s, %dx%d, %d frames (%d warmup), %zu triangles/frame, %s\n",
+      options.model_path,
+      options.width,
+      options.height,
+      options.frames,
+      options.warmup_frames,
+      triangles,
+      clip ? clip->name.c_str() : "no animation");
+
+  Clock::time_point prev_start;
+  double prev_excluded_ms = 0.0;
+  int dumped = 0;
+
+  for (int frame = 0; frame < total_frames; frame++) {
+    Clock::time_point frame_start = Clock::now();
+    bool measured = frame >= options.warmup_frames;
+    if (frame > options.warmup_frames) {
+      frame_ms.push_back(elapsed_ms(prev_start, frame_start) - prev_excluded_ms);
+    }
+    prev_start = frame_start;
+    prev_excluded_ms = 0.0;
+    profile.BeginFrame(measured);
+    BONES_ZONE("frame");
+
+    // Fixed time step, so every run renders exactly the same frames.
+    float time = (float)frame / FrameRate;
+
+    stream.BeginFrame();
+
+    if (clip) {
+      BONES_ZONE("animate");
+      sample_clip(*clip, time, true, pose);
+      local_to_model(model.data.skeleton, pose, joint_to_model.data());
+
+      for (SkinnedMesh& mesh : skinned) {
+        build_skin_palette(*mesh.skin, joint_to_model.data(), mesh.palette.data());
+        SkinPose skin_pose = { mesh.palette.data(), nullptr };
+        skin_vertices(*mesh.skin, skin_pose, SkinningMethod::Linear, &pool, mesh.positions.data(), mesh.normals.data());
+
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+          memcpy(mesh.vertices[v].position, &mesh.positions[v * 3], sizeof(float) * 3);
+          memcpy(mesh.vertices[v].normal, &mesh.normals[v * 3], sizeof(float) * 3);
+        }
+        gpu_meshes[mesh.mesh].UpdateVertices(mesh.vertices.data(), mesh.vertices.size());
+      }
+    }
+
+    gpu_timer.Begin(measured);
+
+    glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glm::mat4 model_mat = glm::translate(glm::mat4(1.0f), center);
+    model_mat = glm::rotate(model_mat, glm::radians(time * RotationSpeed), glm::vec3(0.0f, 1.0f, 0.0f));
+    model_mat = glm::translate(model_mat, -center);
+
+    stream_frame_uniforms(stream, view_mat, projection_mat);
+    GLintptr object_offset = 0;
+    if (ObjectUniforms* object = stream.Allocate<ObjectUniforms>(object_offset)) {
+      memcpy(object->model, glm::value_ptr(model_mat), sizeof(object->model));
+      glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, stream.Buffer(), object_offset, sizeof(ObjectUniforms));
+    }
+    stream.Flush();
+
+    {
+      BONES_ZONE("draw");
+      BONES_GPU_ZONE("draw");
+      for (const GpuMesh& mesh : gpu_meshes) {
+        mesh.Draw();
+      }
+    }
+
+    stream.EndFrame();
+    gpu_timer.End();
+    glFlush();
+    profile.EndFrame(measured);
+
+    if (measured) {
+      cpu_ms.push_back(elapsed_ms(frame_start, Clock::now()));
+      report_frame_allocations("headless", (uint64_t)frame);
+    }
+
+    // Readback and disk time stay out of the frame times.
+    if (options.dump_dir && measured && (frame - options.warmup_frames) % options.dump_every == 0) {
+      Clock::time_point dump_start = Clock::now();
+      pixels.resize((size_t)options.width * options.height * 4);
+      glReadPixels(0, 0, options.width, options.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+      char name[64];
+      snprintf(name, sizeof(name), "/frame_%05d.ppm", frame - options.warmup_frames);
+      if (write_ppm(std::string(options.dump_dir) + name, options.width, options.height, pixels.data())) {
+        dumped++;
+      }
+      prev_excluded_ms = elapsed_ms(dump_start, Clock::now());
+    }
+  }
+
+  glFinish();
+  frame_ms.push_back(elapsed_ms(prev_start, Clock::now()) - prev_excluded_ms);
+  gpu_timer.Finish();
+  bool traced = profile.Finish();
+
+  double total_ms = 0.0;
+  for (double ms : frame_ms) {
+    total_ms += ms;
+  }
+  double fps = 1000.0 * (double)options.frames / total_ms;
+  double triangles_per_second = fps * (double)triangles;
+
+  FrameStats cpu = compute_stats(cpu_ms);
+  FrameStats wall = compute_stats(frame_ms);
+  FrameStats gpu = compute_stats(gpu_timer.samples_ms);
+
+  printf("%10s %10s %10s %10s %10s\n", "", "mean", "p50", "p99", "max");
+  printf("%10s %10.3f %10.3f %10.3f %10.3f\n", "cpu ms", cpu.mean, cpu.p50, cpu.p99, cpu.max);
+  printf("%10s %10.3f %10.3f %10.3f %10.3f\n", "frame ms", wall.mean, wall.p50, wall.p99, wall.max);
+  printf("%10s %10.3f %10.3f %10.3f %10.3f\n", "gpu ms", gpu.mean, gpu.p50, gpu.p99, gpu.max);
+  printf("%.1f fps, %.2f Mtris/s\n", fps, triangles_per_second * 1e-6);
+  print_stream_stats(stream, total_frames);
+  print_frame_profile(profile);
+  if (options.dump_dir) {
+    printf("Dumped %d frames to %s\n", dumped, options.dump_dir);
+  }
+
+  bool ok = true;
+  if (options.report_path) {
+    FILE* file = fopen(options.report_path, "w");
+    if (file) {
+      fprintf(file, "{\n");
+      fprintf(file, "  \"model\": %s,\n", json_string(options.model_path).c_str());
+      fprintf(file, "  \"renderer\": %s,\n", json_string((const char*)glGetString(GL_RENDERER)).c_str());
+      fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n", options.width, options.height);
+      fprintf(file, "  \"frames\": %d,\n  \"triangles_per_frame\": %zu,\n", options.frames, triangles);
+      fprintf(file, "  \"cpu_ms\": %s,\n", json_stats(cpu).c_str());
+      fprintf(file, "  \"frame_ms\": %s,\n", json_stats(wall).c_str());
+      fprintf(file, "  \"gpu_ms\": %s,\n", json_stats(gpu).c_str());
+      fprintf(file, "  \"streaming\": %s,\n", json_stream(stream).c_str());
+      fprintf(file, "  \"fps\": %.3f,\n  \"triangles_per_second\": %.0f\n", fps, triangles_per_second);
+      fprintf(file, "}\n");
+      ok = ferror(file) == 0;
+      fclose(file);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "Failed to write %s\n", options.report_path);
+    }
+  }
+
+  gpu_timer.Destroy();
+  profiler_destroy_gpu();
+  stream.Destroy();
+  for (GpuMesh& mesh : gpu_meshes) {
+    mesh.Destroy();
+  }
+  glDeleteTextures(1, &texture);
+  glDeleteProgram(program);
+  framebuffer.Destroy();
+
+  return ok && traced ? 0 : 1;
+}
+
+int run_crowd_benchmark(const HeadlessOptions& options) {
+  EglContext egl;
+  if (!egl.Create()) {
+    return 1;
+  }
+
+  ThreadPool pool;
+  ModelAsset model;
+  if (!load_model(options.model_path, model, &pool)) {
+    return 1;
+  }
+
+  Framebuffer framebuffer;
+  if (!framebuffer.Create(options.width, options.height)) {
+    return 1;
+  }
+
+  CrowdRenderer crowd;
+  if (!crowd.Init(model)) {
+    return 1;
+  }
+  if (crowd.TrianglesPerInstance() == 0) {
+    fprintf(stderr, "Nothing to render in %s\n", options.model_path);
+    return 1;
+  }
+
+  // Sized for the largest count, every frame writes FrameData, instances and palettes into one region.
+  StreamBuffer stream;
+  size_t max_instances = std::min((size_t)options.max_instances, crowd.MaxInstances());
+  if (!stream.Create(UniformFrameBytes + crowd.FrameBytes(max_instances), options.persistent_streaming) || !crowd.UseStream(stream)) {
+    return 1;
+  }
+  max_instances = std::min(max_instances, crowd.MaxInstances());
+
+  const AnimClip* clip = find_clip(model, options.clip);
+  GLuint texture = load_diffuse_texture(options.texture_path);
+
+  glm::vec3 center;
+  float radius;
+  model_bounds(model, center, radius);
+  float spacing = radius * 2.5f;
+
+  // Four walls a few rows out from the middle, taller than the camera, are the occluders.
+  GLuint wall_program = build_program(MeshVertexShader, MeshFragmentShader);
+  if (!wall_program) {
+    return 1;
+  }
+  glUseProgram(wall_program);
+  glUniform1i(glGetUniformLocation(wall_program, "tex0"), 0);
+  glUseProgram(0);
+
+  std::vector<Vertex> wall_vertices;
+  std::vector<uint16_t> wall_indices;
+  float wall_distance = spacing * 3.25f;
+  for (float side : {-1.0f, 1.0f}) {
+    append_box(glm::vec3(side * wall_distance, radius * 0.75f, 0.0f), glm::vec3(spacing * 0.1f, radius * 1.75f, spacing * 2.0f), wall_vertices, wall_indices);
+    append_box(glm::vec3(0.0f, radius * 0.75f, side * wall_distance), glm::vec3(spacing * 2.0f, radius * 1.75f, spacing * 0.1f), wall_vertices, wall_indices);
+  }
+  MeshView wall_view;
+  wall_view.vertices = wall_vertices.data();
+  wall_view.num_vertices = wall_vertices.size();
+  wall_view.indices = wall_indices.data();
+  wall_view.num_indices = wall_indices.size();
+  wall_view.index_size = 2;
+  GpuMesh walls;
+  walls.Upload(wall_view);
+
+  OcclusionBuffer occlusion;
+  if (!occlusion.Create(std::max(options.width / OcclusionScale, 1), std::max(options.height / OcclusionScale, 1))) {
+    return 1;
+  }
+
+  std::vector<size_t> counts;
+  for (size_t count = 1; count < max_instances; count *= 4) {
+    counts.push_back(count);
+  }
+  counts.push_back(max_instances);
+
+  printf("crowd benchmark: %s, %dx%d, %d frames (%d warmup), %zu triangles and %zu bones per instance, %s, culling %s\n",
+      options.model_path,
+      options.width,
+      options.height,
+      options.frames,
+      options.warmup_frames,
+      crowd.TrianglesPerInstance(),
+      crowd.BonesPerInstance(),
+      clip ? clip->name.c_str() : "no animation",
+      cull_mode_name(options.culling));
+
+  struct Result {
+    size_t instances;
+    double visible;
+    double outside;
+    double occluded;
+    FrameStats cull;
+    FrameStats animate;
+    FrameStats frame;
+    FrameStats gpu;
+    double triangles_per_second;
+    double upload_bytes_per_frame;
+    uint64_t fence_stalls;
+  };
+  std::vector<Result> results;
+
+  glViewport(0, 0, options.width, options.height);
+  glEnable(GL_DEPTH_TEST);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  // Counters and the trace cover the largest count.
+  profiler_create_gpu();
+  FrameProfile profile(options, false);
+  bool traced = true;
+
+  FrameArena frame_arena;
+  std::vector<CrowdInstance> instances;
+  for (size_t count : counts) {
+    // Square grid around the origin, every instance turned and offset in time differently.
+    size_t side = (size_t)std::ceil(std::sqrt((double)count));
+    instances.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      glm::vec3 position(((float)(i % side) - (float)(side - 1) * 0.5f) * spacing, 0.0f, ((float)(i / side) - (float)(side - 1) * 0.5f) * spacing);
+      glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+      transform = glm::rotate(transform, (float)i * 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+      transform = glm::translate(transform, -center);
+      memcpy(instances[i].transform, glm::value_ptr(transform), sizeof(instances[i].transform));
+      instances[i].time_offset = (float)i * 0.13f;
+    }
+
+    // Above the heads in the middle of the crowd, looking down a little while it turns once.
+    float extent = (float)side * spacing;
+    float far_plane = extent * 4.0f + radius * 10.0f;
+    Camera camera(options.width, options.height, glm::vec3(0.0f, radius * 1.5f, 0.0f));
+    glm::mat4 identity(1.0f);
+
+    GpuTimer gpu_timer;
+    gpu_timer.Create();
+    double visible = 0.0;
+    double outside = 0.0;
+    double occluded = 0.0;
+    std::vector<double> cull_ms;
+    std::vector<double> animate_ms;
+    std::vector<double> frame_ms;
+    cull_ms.reserve(options.frames);
+    animate_ms.reserve(options.frames);
+    frame_ms.reserve(options.frames);
+    gpu_timer.samples_ms.reserve(options.frames);
+    StreamStats stream_start = stream.Stats();
+    profile = FrameProfile(options, count == counts.back());
+
+    Clock::time_point prev_start;
+    int total_frames = options.warmup_frames + options.frames;
+    for (int frame = 0; frame < total_frames; frame++) {
+      Clock::time_point frame_start = Clock::now();
+      bool measured = frame >= options.warmup_frames;
+      if (frame > options.warmup_frames) {
+        frame_ms.push_back(elapsed_ms(prev_start, frame_start));
+      }
+      prev_start = frame_start;
+      profile.BeginFrame(measured);
+      BONES_ZONE("frame");
+
+      float yaw = 6.2831853f * (float)frame / (float)total_frames;
+      camera.orientation = glm::vec3(std::cos(yaw), -0.25f, std::sin(yaw));
+      camera.Update(45.0f, radius * 0.05f, far_plane);
+
+      // The occluders go in before the crowd is tested against them.
+      Frustum frustum;
+      camera.BuildFrustum(frustum);
+      Clock::time_point raster_start = Clock::now();
+      if (options.culling == CullMode::Occlusion) {
+        BONES_ZONE("occluders");
+        glm::mat4 view_projection = camera.projection * camera.view;
+        occlusion.Clear(glm::value_ptr(view_projection));
+        occlusion.RasterizeTriangles(glm::value_ptr(identity), wall_vertices[0].position, sizeof(Vertex) / sizeof(float),
+                                     wall_indices.data(), wall_indices.size(), 2);
+      }
+      double raster_ms = elapsed_ms(raster_start, Clock::now());
+
+      stream.BeginFrame();
+      stream_frame_uniforms(stream, camera.view, camera.projection);
+      GLintptr wall_offset = 0;
+      ObjectUniforms* wall_object = stream.Allocate<ObjectUniforms>(wall_offset);
+      if (wall_object) {
+        memcpy(wall_object->model, glm::value_ptr(identity), sizeof(wall_object->model));
+      }
+      crowd.Animate(instances.data(), instances.size(), clip, (float)frame / FrameRate, &pool, stream, frame_arena,
+                    options.culling != CullMode::Off ? &frustum : nullptr,
+                    options.culling == CullMode::Occlusion ? &occlusion : nullptr);
+      if (measured) {
+        animate_ms.push_back(elapsed_ms(frame_start, Clock::now()));
+        const CrowdCullStats& cull = crowd.CullStats();
+        visible += (double)cull.visible;
+        outside += (double)cull.outside;
+        occluded += (double)cull.occluded;
+        cull_ms.push_back(cull.cull_ms + raster_ms);
+      }
+
+      gpu_timer.Begin(measured);
+      {
+        BONES_GPU_ZONE("draw");
+        glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        crowd.Draw(stream);
+        if (wall_object) {
+          glUseProgram(wall_program);
+          glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, stream.Buffer(), wall_offset, sizeof(ObjectUniforms));
+          walls.Draw();
+        }
+      }
+      stream.EndFrame();
+      gpu_timer.End();
+      glFlush();
+      frame_arena.Reset();
+      profile.EndFrame(measured);
+      if (measured) {
+        report_frame_allocations("crowd", (uint64_t)frame);
+      }
+    }
+
+    glFinish();
+    frame_ms.push_back(elapsed_ms(prev_start, Clock::now()));
+    gpu_timer.Finish();
+    gpu_timer.Destroy();
+    traced = profile.Finish() && traced;
+
+    if (options.dump_dir) {
+      std::vector<uint8_t> pixels((size_t)options.width * options.height * 4);
+      glReadPixels(0, 0, options.width, options.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+      char name[64];
+      snprintf(name, sizeof(name), "/crowd_%05zu.ppm", instances.size());
+      write_ppm(std::string(options.dump_dir) + name, options.width, options.height, pixels.data());
+    }
+
+    Result result;
+    result.instances = std::min(instances.size(), crowd.MaxInstances());
+    result.visible = visible / (double)options.frames;
+    result.outside = outside / (double)options.frames;
+    result.occluded = occluded / (double)options.frames;
+    result.cull = compute_stats(cull_ms);
+    result.animate = compute_stats(animate_ms);
+    result.frame = compute_stats(frame_ms);
+    result.gpu = compute_stats(gpu_timer.samples_ms);
+    result.triangles_per_second = result.frame.mean > 0.0 ? 1000.0 * result.visible * (double)crowd.TrianglesPerInstance() / result.frame.mean : 0.0;
+    result.upload_bytes_per_frame = (double)(stream.Stats().bytes_uploaded - stream_start.bytes_uploaded) / (double)total_frames;
+    result.fence_stalls = stream.Stats().fence_stalls - stream_start.fence_stalls;
+    results.push_back(result);
+  }
+
+  printf("%10s %9s %9s %9s %8s %14s %10s %12s %12s %12s %12s %10s %10s %8s\n",
+      "instances", "visible", "outside", "occluded", "draws", "draws w/o inst", "cull ms", "animate ms", "frame ms", "frame p99", "gpu ms", "Mtris/s", "KB/frame", "stalls");
+  for (const Result& result : results) {
+    printf("%10zu %9.1f %9.1f %9.1f %8zu %14zu %10.3f %12.3f %12.3f %12.3f %12.3f %10.2f %10.1f %8llu\n",
+        result.instances,
+        result.visible,
+        result.outside,
+        result.occluded,
+        crowd.DrawCalls(),
+        crowd.DrawCalls() * result.instances,
+        result.cull.p50,
+        result.animate.p50,
+        result.frame.p50,
+        result.frame.p99,
+        result.gpu.p50,
+        result.triangles_per_second * 1e-6,
+        result.upload_bytes_per_frame / 1024.0,
+        (unsigned long long)result.fence_stalls);
+  }
+  print_stream_stats(stream, (int)results.size() * (options.warmup_frames + options.frames));
+  print_frame_profile(profile);
+
+  bool ok = true;
+  if (options.report_path) {
+    FILE* file = fopen(options.report_path, "w");
+    if (file) {
+      fprintf(file, "{\n");
+      fprintf(file, "  \"model\": %s,\n", json_string(options.model_path).c_str());
+      fprintf(file, "  \"renderer\": %s,\n", json_string((const char*)glGetString(GL_RENDERER)).c_str());
+      fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n", options.width, options.height);
+      fprintf(file, "  \"frames\": %d,\n  \"draw_calls\": %zu,\n", options.frames, crowd.DrawCalls());
+      fprintf(file, "  \"culling\": %s,\n", json_string(cull_mode_name(options.culling)).c_str());
+      fprintf(file, "  \"streaming\": %s,\n", json_stream(stream).c_str());
+      fprintf(file, "  \"runs\": [\n");
+      for (size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        fprintf(file, "    {\"instances\": %zu, \"visible\": %.1f, \"outside\": %.1f, \"occluded\": %.1f, \"cull_ms\": %s, \"animate_ms\": %s, \"frame_ms\": %s, \"gpu_ms\": %s, \"triangles_per_second\": %.0f, \"upload_bytes_per_frame\": %.0f, \"fence_stalls\": %llu}%s\n",
+            result.instances,
+            result.visible,
+            result.outside,
+            result.occluded,
+            json_stats(result.cull).c_str(),
+            json_stats(result.animate).c_str(),
+            json_stats(result.frame).c_str(),
+            json_stats(result.gpu).c_str(),
+            result.triangles_per_second,
+            result.upload_bytes_per_frame,
+            (unsigned long long)result.fence_stalls,
+            i + 1 < results.size() ? "," : "");
+      }
+      fprintf(file, "  ]\n}\n");
+      ok = ferror(file) == 0;
+      fclose(file);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "Failed to write %s\n", options.report_path);
+    }
+  }
+
+  profiler_destroy_gpu();
+  crowd.Destroy();
+  walls.Destroy();
+  glDeleteProgram(wall_program);
+  stream.Destroy();
+  glDeleteTextures(1, &texture);
+  framebuffer.Destroy();
+
+  return ok && traced ? 0 : 1;
+}
+
+int run_texture_benchmark(const HeadlessOptions& options) {
+  EglContext egl;
+  if (!egl.Create()) {
+    return 1;
+  }
+
+  ThreadPool pool;
+  std::vector<std::string> sources;
+  if (is_model_path(options.model_path)) {
+    ModelAsset model;
+    if (load_model(options.model_path, model, &pool)) {
+      sources = model.data.textures;
+    }
+  }
+  if (sources.empty()) {
+    sources.emplace_back(options.texture_path);
+  }
+
+  Framebuffer framebuffer;
+  if (!framebuffer.Create(options.width, options.height)) {
+    return 1;
+  }
+
+  GLuint program = build_program(MeshVertexShader, MeshFragmentShader);
+  if (!program) {
+    return 1;
+  }
+
+  // A camera pans over a grid of the textures, a quarter of them on screen at once.
+  size_t num_textures = (size_t)options.num_textures;
+  size_t visible = std::max<size_t>(num_textures / 4, 1);
+  int columns = (int)std::ceil(std::sqrt((double)visible));
+
+  StreamBuffer stream;
+  if (!stream.Create(UniformFrameBytes + visible * 256, options.persistent_streaming)) {
+    return 1;
+  }
+
+  const Vertex quad_vertices[4] = {
+    {{0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 0.0f}},
+    {{1.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 0.0f}},
+    {{1.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}},
+    {{0.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}},
+  };
+  const uint16_t quad_indices[6] = {0, 1, 2, 0, 2, 3};
+  MeshView quad_view;
+  quad_view.vertices = quad_vertices;
+  quad_view.num_vertices = 4;
+  quad_view.indices = quad_indices;
+  quad_view.num_indices = 6;
+  quad_view.index_size = 2;
+  GpuMesh quad;
+  quad.Upload(quad_view);
+
+  TextureStreamer textures(pool);
+  size_t budget = (size_t)options.texture_budget_mb << 20;
+  if (!textures.Create(budget)) {
+    return 1;
+  }
+
+  printf("texture streaming benchmark: %zu textures from %zu files, %d MB budget, %zu visible, %d frames\n",
+      num_textures,
+      sources.size(),
+      options.texture_budget_mb,
+      visible,
+      options.frames);
+
+  Clock::time_point start = Clock::now();
+  std::vector<uint32_t> handles(num_textures);
+  for (size_t i = 0; i < num_textures; i++) {
+    handles[i] = textures.Request(sources[i % sources.size()].c_str());
+  }
+  double request_ms = elapsed_ms(start, Clock::now());
+
+  glViewport(0, 0, options.width, options.height);
+  glDisable(GL_DEPTH_TEST);
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "tex0"), 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  printf("%8s %10s %10s %12s %12s %12s %12s %10s\n",
+      "frame", "resident", "complete", "resident MB", "peak MB", "uploaded MB", "evicted MB", "update ms");
+
+  std::vector<GLintptr> cell_offsets(visible);
+  std::vector<uint8_t> pixels;
+  double idle_ms = -1.0;
+  int idle_frame = -1;
+  double prev_update_ms = 0.0;
+  glm::mat4 identity(1.0f);
+  profiler_create_gpu();
+  FrameProfile profile(options, true);
+
+  for (int frame = 0; frame < options.frames; frame++) {
+    profile.BeginFrame(true);
+    BONES_ZONE("frame");
+    textures.Update();
+    const TextureStreamStats& stats = textures.Stats();
+    double update_ms = stats.update_ms - prev_update_ms;
+    prev_update_ms = stats.update_ms;
+    if (idle_frame < 0 && textures.Idle()) {
+      idle_frame = frame;
+      idle_ms = elapsed_ms(start, Clock::now());
+    }
+
+    stream.BeginFrame();
+    glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    stream_frame_uniforms(stream, identity, identity);
+
+    // The window wraps around the textures once over the run.
+    size_t first = (size_t)frame * num_textures / (size_t)options.frames;
+    float cell = 2.0f / (float)columns;
+    size_t cells = 0;
+    while (cells < visible) {
+      ObjectUniforms* object = stream.Allocate<ObjectUniforms>(cell_offsets[cells]);
+      if (!object) {
+        break;
+      }
+      glm::vec3 corner(-1.0f + cell * (float)(cells % columns), -1.0f + cell * (float)(cells / columns), 0.0f);
+      glm::mat4 model_mat = glm::scale(glm::translate(identity, corner), glm::vec3(cell * 0.95f));
+      memcpy(object->model, glm::value_ptr(model_mat), sizeof(object->model));
+      cells++;
+    }
+    stream.Flush();
+
+    {
+      BONES_GPU_ZONE("draw");
+      for (size_t k = 0; k < cells; k++) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, stream.Buffer(), cell_offsets[k], sizeof(ObjectUniforms));
+        glBindTexture(GL_TEXTURE_2D, textures.Use(handles[(first + k) % num_textures]));
+        quad.Draw();
+      }
+    }
+    stream.EndFrame();
+    glFlush();
+    profile.EndFrame(true);
+
+    bool last = frame + 1 == options.frames;
+    if ((frame & (frame + 1)) == 0 || last) {
+      printf("%8d %10zu %10zu %12.2f %12.2f %12.2f %12.2f %10.3f\n",
+          frame + 1,
+          stats.resident_textures,
+          stats.complete_textures,
+          (double)stats.resident_bytes / (1024.0 * 1024.0),
+          (double)stats.peak_resident_bytes / (1024.0 * 1024.0),
+          (double)stats.uploaded_bytes / (1024.0 * 1024.0),
+          (double)stats.evicted_bytes / (1024.0 * 1024.0),
+          update_ms);
+    }
+
+    if (options.dump_dir && last) {
+      pixels.resize((size_t)options.width * options.height * 4);
+      glReadPixels(0, 0, options.width, options.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+      write_ppm(std::string(options.dump_dir) + "/textures.ppm", options.width, options.height, pixels.data());
+    }
+  }
+  glFinish();
+  bool traced = profile.Finish();
+
+  const TextureStreamStats& stats = textures.Stats();
+  printf("requests queued in %.2f ms, every texture had a level after %.2f ms and all of its levels after %.2f ms\n",
+      request_ms,
+      stats.first_level_ms,
+      stats.complete_ms);
+  if (idle_frame >= 0) {
+    printf("streaming settled at frame %d (%.2f ms), %zu of %zu textures complete within the budget\n",
+        idle_frame + 1,
+        idle_ms,
+        stats.complete_textures,
+        stats.textures);
+  } else {
+    printf("streaming had not settled after %d frames\n", options.frames);
+  }
+  printf("resident %.2f MB of %.2f MB (peak %.2f MB), uploaded %.2f MB, evicted %.2f MB in %llu levels, %.3f ms/frame in Update\n",
+      (double)stats.resident_bytes / (1024.0 * 1024.0),
+      (double)budget / (1024.0 * 1024.0),
+      (double)stats.peak_resident_bytes / (1024.0 * 1024.0),
+      (double)stats.uploaded_bytes / (1024.0 * 1024.0),
+      (double)stats.evicted_bytes / (1024.0 * 1024.0),
+      (unsigned long long)stats.evicted_levels,
+      stats.update_ms / (double)options.frames);
+  print_frame_profile(profile);
+
+  bool ok = stats.failed_textures == 0 && traced;
+  if (options.report_path) {
+    FILE* file = fopen(options.report_path, "w");
+    bool written = false;
+    if (file) {
+      fprintf(file, "{\n");
+      fprintf(file, "  \"model\": %s,\n", json_string(options.model_path).c_str());
+      fprintf(file, "  \"renderer\": %s,\n", json_string((const char*)glGetString(GL_RENDERER)).c_str());
+      fprintf(file, "  \"textures\": %zu,\n  \"budget_bytes\": %zu,\n  \"frames\": %d,\n", num_textures, budget, options.frames);
+      fprintf(file, "  \"first_level_ms\": %.4f,\n  \"complete_ms\": %.4f,\n  \"settled_ms\": %.4f,\n",
+          stats.first_level_ms, stats.complete_ms, idle_ms);
+      fprintf(file, "  \"resident_bytes\": %zu,\n  \"peak_resident_bytes\": %zu,\n", stats.resident_bytes, stats.peak_resident_bytes);
+      fprintf(file, "  \"uploaded_bytes\": %llu,\n  \"evicted_bytes\": %llu,\n",
+          (unsigned long long)stats.uploaded_bytes, (unsigned long long)stats.evicted_bytes);
+      fprintf(file, "  \"update_ms_per_frame\": %.4f\n", stats.update_ms / (double)options.frames);
+      fprintf(file, "}\n");
+      written = ferror(file) == 0;
+      fclose(file);
+    }
+    if (!written) {
+      fprintf(stderr, "Failed to write %s\n", options.report_path);
+      ok = false;
+    }
+  }
+
+  profiler_destroy_gpu();
+  textures.Destroy();
+  quad.Destroy();
+  stream.Destroy();
+  glDeleteProgram(program);
+  framebuffer.Destroy();
+
+  return ok ? 0 : 1;
+}
+
+#else
+
+int run_headless_benchmark(const HeadlessOptions&) {
+  fprintf(stderr, "bones was built without headless support (BONES_HEADLESS)\n");
+  return 1;
+}
+
+int run_crowd_benchmark(const HeadlessOptions&) {
+  fprintf(stderr, "bones was built without headless support (BONES_HEADLESS)\n");
+  return 1;
+}
+
+int run_texture_benchmark(const HeadlessOptions&) {
+  fprintf(stderr, "bones was built without headless support (BONES_HEADLESS)\n");
+  return 1;
+}
+
+#endif
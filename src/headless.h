@@ -0,0 +1,51 @@
+#pragma once
+
+enum class CullMode {
+  Off,
+  Frustum,
+  Occlusion, // frustum, then the software occlusion buffer
+};
+
+struct HeadlessOptions {
+  const char* model_path = "../assets/teapot.fbx";
+  const char* texture_path = "../assets/texture128.png";
+  int width = 1280;
+  int height = 720;
+  int frames = 300;
+  int warmup_frames = 10;
+  int clip = 0;
+  const char* dump_dir = nullptr;
+  int dump_every = 1;
+  const char* report_path = nullptr;
+  int max_instances = 1024;
+  bool persistent_streaming = true; // false forces the glBufferSubData path
+  int num_textures = 256;
+  int texture_budget_mb = 64;
+  CullMode culling = CullMode::Occlusion;
+  const char* trace_path = nullptr; // Chrome trace of the measured frames, needs BONES_PROFILER
+};
+
+// Parses "[model] [--frames N] [--warmup N] [--size WxH] [--clip N] [--texture file]
+// [--dump dir] [--dump-every N] [--report file.json] [--instances N]
+// [--streaming persistent|orphan] [--textures N] [--budget MB] [--culling off|frustum|occlusion]
+// [--trace file.json]".
+bool parse_headless_args(int argc, char** argv, HeadlessOptions& out);
+
+// Renders a fixed number of frames of the model, animated with its clip, into an
+// offscreen framebuffer on an EGL context that needs no window or display (Mesa
+// llvmpipe works). Prints CPU, wall and GPU frame time percentiles and triangle
+// throughput, optionally dumping frames as PPM and the results as JSON.
+int run_headless_benchmark(const HeadlessOptions& options);
+
+// Renders instanced crowds of the model at 1, 4, 16... instances up to max_instances
+// and prints draw calls, animation cost and frame times per count. The camera turns
+// once over the run from above the middle of the crowd, behind a ring of walls that
+// serve as occluders, and every count reports how many instances culling kept.
+// With a dump directory the last frame of every count is written out.
+int run_crowd_benchmark(const HeadlessOptions& options);
+
+// Streams num_textures copies of the model's material textures (or of the texture
+// when it has none) through a TextureStreamer with the budget, while a camera pans
+// over a grid of them. Prints residency as it fills up, then how long until every
+// texture had its first and all of its levels, resident memory and evictions.
+int run_texture_benchmark(const HeadlessOptions& options);
@@ -1,59 +1,36 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-
-#include "ufbx.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "allocators.h"
+#include "asset.h"
+#include "asset_loader.h"
+#include "bench.h"
+#include "camera.h"
+#include "culling.h"
+#include "headless.h"
+#include "profiler.h"
+#include "shader.h"
+#include "stream_buffer.h"
+#include "texture_streamer.h"
+#include "thread_pool.h"
 #include <GL/glew.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_opengl.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 constexpr int Width  = 600;
 constexpr int Height = 600;
-
-const char* vertexShaderSource = R"(
-  #version 330 core
-  layout (location = 0) in vec3 aPos;
-  layout (location = 1) in vec3 aColor;
-  layout (location = 2) in vec2 aTex;
-
-  out vec3 color;
-  out vec2 texCoord;
-
-  uniform float scale;
-
-  uniform mat4 model;
-  uniform mat4 view;
-  uniform mat4 projection;
-
-  void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    color = aColor;
-    texCoord = aTex;
-  }
-)";
-
-const char* fragmentShaderSource = R"(
-  #version 330 core
-  out vec4 FragColor;
-
-  in vec3 color;
-  in vec2 texCoord;
-
-  uniform sampler2D tex0;
-
-  void main() {
-    FragColor = texture(tex0, texCoord);
-  }
-)";
-
-struct Vertex {
-  float position[3];
-};
+constexpr size_t StreamFrameBytes = 4096;
+constexpr const char* TracePath = "bones-trace.json";
 
 constexpr float s = 1.73205080757f;// sqrtf(3.0f);
 GLfloat vertices[] = {
@@ -74,35 +51,69 @@ GLuint indices[] = {
   3, 0, 4
 };
 
-bool load_fbx(const char* path, std::vector<Vertex>& out_vertices) {
-  ufbx_load_opts opts = {0};
-  ufbx_error error;
-  ufbx_scene *scene = ufbx_load_file(path, &opts, &error);
+double ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+  auto start_time = std::chrono::steady_clock::now();
+  profiler_set_thread_name("main");
+
+  if (argc >= 2 && strcmp(argv[1], "--bench-skinning") == 0) {
+    return run_skinning_benchmark(argc >= 3 ? argv[2] : "../assets/teapot.fbx");
+  }
 
-  if (!scene) {
-    fprintf(stderr, "Failed to load: %s\n", error.description.data);
-    return false;
+  if (argc >= 2 && strcmp(argv[1], "--bench-anim") == 0) {
+    return run_animation_benchmark(argc >= 3 ? argv[2] : "../assets/teapot.fbx", argc >= 4 ? (float)atof(argv[3]) : 0.0f);
   }
 
-  for (size_t i = 0; i < scene->meshes.count; i++) {
-    ufbx_mesh* mesh = scene->meshes[i];
-    const ufbx_vec3* positions = mesh->vertex_position.values.data;
-
-    for (size_t j = 0; j < mesh->num_vertices; j++) {
-      Vertex v;
-      ufbx_vec3 pos = positions[j];
-      v.position[0] = (float)pos.x;
-      v.position[1] = (float)pos.y;
-      v.position[2] = (float)pos.z;
-      out_vertices.push_back(v);
+  if (argc >= 2 && strcmp(argv[1], "--bench-loading") == 0) {
+    std::vector<const char*> paths(argv + 2, argv + argc);
+    if (paths.empty()) {
+      paths = {"../assets/teapot.fbx", "../assets/texture128.png"};
     }
+    return run_loading_benchmark(paths);
   }
 
-  ufbx_free_scene(scene);
-  return true;
-}
+  if (argc >= 2 && strcmp(argv[1], "--headless") == 0) {
+    HeadlessOptions options;
+    if (!parse_headless_args(argc - 2, argv + 2, options)) {
+      return 1;
+    }
+    return run_headless_benchmark(options);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--bench-crowd") == 0) {
+    HeadlessOptions options;
+    options.frames = 60;
+    if (!parse_headless_args(argc - 2, argv + 2, options)) {
+      return 1;
+    }
+    return run_crowd_benchmark(options);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--bench-textures") == 0) {
+    HeadlessOptions options;
+    options.frames = 120;
+    if (!parse_headless_args(argc - 2, argv + 2, options)) {
+      return 1;
+    }
+    return run_texture_benchmark(options);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--bake") == 0) {
+    bool ok = true;
+    bool high_quality = false;
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "--bc7") == 0) {
+        high_quality = true;
+        continue;
+      }
+      ok = (is_model_path(argv[i]) ? bake_model(argv[i], high_quality) : bake_texture(argv[i], high_quality)) && ok;
+    }
+    return ok ? 0 : 1;
+  }
 
-int main(int argc, char* argv[]) {
   if (!SDL_Init(SDL_INIT_VIDEO)) {
     std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl;
     return 1;
@@ -139,34 +150,47 @@ int main(int argc, char* argv[]) {
     std::cerr << "Failed to initialize GLEW!" << std::endl;
     return 1;
   }
+  profiler_create_gpu();
 
   glViewport(0, 0, Width, Height);
 
-  // std::vector<Vertex> vertices;
-  // std::vector<GLuint> indices;
-  // if (argc < 2) {
-  //   test_object(vertices, indices);
-  // } else {
-  //   if (!load_fbx(argv[1], vertices)) {
-  //     return 1;
-  //   }
-  // }
-
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-  glCompileShader(vertexShader);
-
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-  glCompileShader(fragmentShader);
+  // Everything loads in the background, the pyramid stands in until the models arrive
+  // and textures draw white until their coarsest mips are streamed in.
+  ThreadPool loader_pool;
+  AssetLoader loader(loader_pool);
+  TextureStreamer textures(loader_pool);
+  if (!textures.Create()) {
+    return 1;
+  }
 
-  GLuint shaderProgram = glCreateProgram();
-  glAttachShader(shaderProgram, vertexShader);
-  glAttachShader(shaderProgram, fragmentShader);
-  glLinkProgram(shaderProgram);
+  std::unordered_map<std::string, uint32_t> texture_handles;
+  auto request_texture = [&](const std::string& path) {
+    auto found = texture_handles.find(path);
+    if (found != texture_handles.end()) {
+      return found->second;
+    }
+    uint32_t handle = textures.Request(path.c_str());
+    texture_handles.emplace(path, handle);
+    return handle;
+  };
+
+  // Untextured meshes use the last texture on the command line.
+  uint32_t default_texture = UINT32_MAX;
+  for (int i = 1; i < argc; i++) {
+    if (is_model_path(argv[i])) {
+      loader.Request(argv[i]);
+    } else {
+      default_texture = request_texture(argv[i]);
+    }
+  }
+  if (default_texture == UINT32_MAX) {
+    default_texture = request_texture("../assets/texture128.png");
+  }
 
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+  GLuint shaderProgram = build_program(MeshVertexShader, MeshFragmentShader);
+  if (!shaderProgram) {
+    return 1;
+  }
 
   GLuint vao, vbo, ebo;
 
@@ -193,73 +217,43 @@ int main(int argc, char* argv[]) {
   glBindVertexArray(0);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-  GLuint uniID = glGetUniformLocation(shaderProgram, "scale");
+  std::vector<GpuMesh> gpu_meshes;
+  std::vector<uint32_t> mesh_textures;
+  std::vector<Aabb> mesh_bounds;
 
-  // texture
-  int tex_width, tex_heigth, tex_ch;
-  stbi_set_flip_vertically_on_load(true);
-  unsigned char* texture_bytes = stbi_load(
-      "../assets/texture128.png",
-      &tex_width,
-      &tex_heigth,
-      &tex_ch,
-      0);
-
-  if (texture_bytes == NULL) {
-    std::cerr << "Failed to load texture " << std::endl;
-    return 1;
-  }
+  GLuint uniID = glGetUniformLocation(shaderProgram, "scale");
 
-  GLuint texture;
-  glGenTextures(1, &texture);
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texture);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-  glTexImage2D(
-      GL_TEXTURE_2D,
-      0,
-      GL_RGBA,
-      tex_width,
-      tex_heigth,
-      0,
-      GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      texture_bytes);
-  glGenerateMipmap(GL_TEXTURE_2D);
-
-  stbi_image_free(texture_bytes);
-  glBindTexture(GL_TEXTURE_2D, 0);
-
   GLuint tex0uni = glGetUniformLocation(shaderProgram, "tex0");
   glUseProgram(shaderProgram);
   glUniform1i(tex0uni, 0);
 
+  // Camera and model matrices go through uniform blocks in a ring the CPU writes into directly.
+  StreamBuffer stream;
+  if (!stream.Create(StreamFrameBytes)) {
+    return 1;
+  }
+
+  // Scratch for this frame only, once the assets are in the loop never touches the heap.
+  FrameArena frame_arena;
+  uint64_t frame = 0;
+
   bool running = true;
   SDL_Event event;
 
-  glm::mat4 view_mat = glm::mat4(1.0f);
-  glm::mat4 projection_mat = glm::mat4(1.0f);
-
-  view_mat = glm::translate(view_mat, glm::vec3(0.0f, -0.3f, -3.0f));
-  projection_mat = glm::perspective(
-      glm::radians(45.0f),
-      (float)(Width / Height),
-      0.1f,
-      100.0f
-    );
+  Camera camera(Width, Height, glm::vec3(0.0f, 0.3f, 3.0f));
+  camera.Update(45.0f, 0.1f, 100.0f);
 
   float rotation = 0.0f;
   uint64_t prev_time = SDL_GetTicks();
 
   glEnable(GL_DEPTH_TEST);
 
+  bool first_frame = true;
+  bool assets_ready = false;
+
   while (running) {
+    BONES_ZONE("frame");
     while (SDL_PollEvent(&event)) {
       switch (event.type) {
         case SDL_EVENT_QUIT:
@@ -268,15 +262,54 @@ int main(int argc, char* argv[]) {
         case SDL_EVENT_KEY_DOWN:
           if (event.key.key == SDLK_ESCAPE) {
             running = false;
+          } else if (event.key.key == SDLK_P && !event.key.repeat) {
+            // P starts a capture and P again writes it out.
+            if (!profiler_capturing()) {
+              profiler_begin_capture();
+              printf("Profiling, press P again to write %s\n", TracePath);
+            } else if (profiler_end_capture(TracePath)) {
+              printf("Wrote %s\n", TracePath);
+            }
           }
           break;
       }
     }
 
+    std::unique_ptr<LoadedAsset> asset;
+    {
+      BONES_ZONE("poll assets");
+      while (loader.Poll(asset)) {
+        if (!asset->ok) {
+          std::cerr << "Failed to load " << asset->path << std::endl;
+          continue;
+        }
+
+        // Cached meshes point into the mapped file, so the upload is the only copy of the data.
+        const ModelData& data = asset->model.data;
+        for (const MeshView& view : asset->model.meshes) {
+          gpu_meshes.emplace_back();
+          gpu_meshes.back().Upload(view);
+          mesh_textures.push_back(view.texture >= 0 ? request_texture(data.textures[view.texture]) : default_texture);
+          mesh_bounds.push_back(view.bounds);
+        }
+      }
+    }
+    textures.Update();
+
+    if (!assets_ready && loader.Pending() == 0 && textures.Idle()) {
+      assets_ready = true;
+      const TextureStreamStats& texture_stats = textures.Stats();
+      printf("All assets ready after %.2f ms, %zu textures in %.2f MB\n",
+          ms_since(start_time),
+          texture_stats.resident_textures,
+          (double)texture_stats.resident_bytes / (1024.0 * 1024.0));
+    }
+
     glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glUseProgram(shaderProgram);
+    stream.BeginFrame();
 
     uint64_t current_time = SDL_GetTicks();
     uint64_t elapsed = current_time - prev_time;
@@ -288,26 +321,74 @@ int main(int argc, char* argv[]) {
     glm::mat4 model_mat = glm::mat4(1.0f);
     model_mat = glm::rotate(model_mat, glm::radians(rotation), glm::vec3(0.0f, 1.0f, 0.0f));
 
-    int model_location = glGetUniformLocation(shaderProgram, "model");
-    glUniformMatrix4fv(model_location, 1, GL_FALSE, glm::value_ptr(model_mat));
-    int view_location = glGetUniformLocation(shaderProgram, "view");
-    glUniformMatrix4fv(view_location, 1, GL_FALSE, glm::value_ptr(view_mat));
-    int projection_location = glGetUniformLocation(shaderProgram, "projection");
-    glUniformMatrix4fv(projection_location, 1, GL_FALSE, glm::value_ptr(projection_mat));
+    GLintptr frame_offset = 0;
+    GLintptr object_offset = 0;
+    FrameUniforms* frame_data = stream.Allocate<FrameUniforms>(frame_offset);
+    ObjectUniforms* object_data = stream.Allocate<ObjectUniforms>(object_offset);
+    memcpy(frame_data->view, glm::value_ptr(camera.view), sizeof(frame_data->view));
+    memcpy(frame_data->projection, glm::value_ptr(camera.projection), sizeof(frame_data->projection));
+    memcpy(object_data->model, glm::value_ptr(model_mat), sizeof(object_data->model));
+    stream.Flush();
+    glBindBufferRange(GL_UNIFORM_BUFFER, FrameBlockBinding, stream.Buffer(), frame_offset, sizeof(FrameUniforms));
+    glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, stream.Buffer(), object_offset, sizeof(ObjectUniforms));
 
     glUniform1f(uniID, 0.5f);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glBindVertexArray(vao);
+    {
+      BONES_ZONE("draw");
+      BONES_GPU_ZONE("draw");
+      if (gpu_meshes.empty()) {
+        glBindTexture(GL_TEXTURE_2D, textures.Use(default_texture));
+        glBindVertexArray(vao);
+        glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(GLuint), GL_UNSIGNED_INT, 0);
+        BONES_COUNT(ProfileCounter::DrawCalls, 1);
+        BONES_COUNT(ProfileCounter::Triangles, sizeof(indices) / sizeof(GLuint) / 3);
+      } else {
+        // Planes of the whole transform are in model space, so the mesh boxes go in as they are.
+        Frustum frustum;
+        uint8_t* mesh_visible = frame_arena.Allocate<uint8_t>(gpu_meshes.size());
+        glm::mat4 model_view_projection = camera.projection * camera.view * model_mat;
+        frustum_from_matrix(glm::value_ptr(model_view_projection), frustum);
+        for (size_t first = 0; first < gpu_meshes.size(); first += CullBatchSize) {
+          CullBatch batch;
+          for (size_t i = first; i < std::min(first + CullBatchSize, gpu_meshes.size()); i++) {
+            batch.AddBox(mesh_bounds[i]);
+          }
+          frustum_cull_boxes(frustum, batch, mesh_visible + first);
+        }
 
-    glDrawElements(GL_TRIANGLES, sizeof(indices) / sizeof(int), GL_UNSIGNED_INT, 0);
+        for (size_t i = 0; i < gpu_meshes.size(); i++) {
+          if (mesh_visible[i]) {
+            glBindTexture(GL_TEXTURE_2D, textures.Use(mesh_textures[i]));
+            gpu_meshes[i].Draw();
+          }
+        }
+      }
+    }
+    stream.EndFrame();
 
     SDL_GL_SwapWindow(window);
+
+    if (first_frame) {
+      first_frame = false;
+      printf("First frame after %.2f ms\n", ms_since(start_time));
+    }
+    frame_arena.Reset();
+    profiler_frame();
+    if (assets_ready) {
+      report_frame_allocations("main", frame);
+    }
+    frame++;
   }
 
+  for (GpuMesh& mesh : gpu_meshes) {
+    mesh.Destroy();
+  }
+  stream.Destroy();
+  textures.Destroy();
+  profiler_destroy_gpu();
   glDeleteVertexArrays(1, &vao);
   glDeleteBuffers(1, &vbo);
   glDeleteBuffers(1, &ebo);
-  glDeleteTextures(1, &texture);
   glDeleteProgram(shaderProgram);
 
   SDL_GL_DestroyContext(context);
@@ -0,0 +1,119 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+#if defined(_WIN32)
+    std::swap(file, other.file);
+    std::swap(mapping, other.mapping);
+#endif
+  }
+  return *this;
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char* path) {
+  Close();
+
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(handle);
+    return false;
+  }
+
+  HANDLE map = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!map) {
+    CloseHandle(handle);
+    return false;
+  }
+
+  void* view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    CloseHandle(map);
+    CloseHandle(handle);
+    return false;
+  }
+
+  file = handle;
+  mapping = map;
+  data = (const uint8_t*)view;
+  size = (size_t)file_size.QuadPart;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data) {
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mapping);
+    CloseHandle((HANDLE)file);
+  }
+  data = nullptr;
+  size = 0;
+  file = nullptr;
+  mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const char* path) {
+  Close();
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    return false;
+  }
+
+  data = (const uint8_t*)view;
+  size = (size_t)st.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data) {
+    munmap((void*)data, size);
+  }
+  data = nullptr;
+  size = 0;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const char* path);
+  void Close();
+
+  const uint8_t* Data() const { return data; }
+  size_t Size() const { return size; }
+
+private:
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+#if defined(_WIN32)
+  void* file = nullptr;
+  void* mapping = nullptr;
+#endif
+};
@@ -1 +1,328 @@
 #include "mesh.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "profiler.h"
+
+namespace {
+
+constexpr int VertexCacheSize = 32;
+constexpr uint32_t NoIndex = UINT32_MAX;
+
+float vertex_score(int cache_position, uint32_t remaining_triangles) {
+  if (remaining_triangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // The last triangle's vertices get a fixed score so it is not immediately reused.
+      score = 0.75f;
+    } else {
+      float scale = 1.0f / (VertexCacheSize - 3);
+      score = std::pow(1.0f - (float)(cache_position - 3) * scale, 1.5f);
+    }
+  }
+
+  // Boost vertices with few triangles left so they get finished off.
+  return score + 2.0f / std::sqrt((float)remaining_triangles);
+}
+
+} // namespace
+
+VertexCacheStats analyze_vertex_cache(const uint32_t* indices, size_t num_indices, size_t num_vertices) {
+  VertexCacheStats stats;
+  if (num_indices == 0 || num_vertices == 0) {
+    return stats;
+  }
+
+  // stamp[v] is the miss count when v entered the FIFO, 0 if it never did.
+  std::vector<uint32_t> stamp(num_vertices, 0);
+  uint32_t misses = 0;
+  for (size_t i = 0; i < num_indices; i++) {
+    uint32_t v = indices[i];
+    if (stamp[v] == 0 || misses - stamp[v] >= VertexCacheSize) {
+      stamp[v] = ++misses;
+    }
+  }
+
+  stats.acmr = (float)misses / (float)(num_indices / 3);
+  stats.atvr = (float)misses / (float)num_vertices;
+  return stats;
+}
+
+void optimize_vertex_cache(uint32_t* indices, size_t num_indices, size_t num_vertices) {
+  size_t num_triangles = num_indices / 3;
+  if (num_triangles == 0) {
+    return;
+  }
+
+  // Vertex to triangle adjacency, each list shrinks as its triangles are emitted.
+  std::vector<uint32_t> remaining(num_vertices, 0);
+  for (size_t i = 0; i < num_indices; i++) {
+    remaining[indices[i]]++;
+  }
+
+  std::vector<uint32_t> offsets(num_vertices + 1, 0);
+  for (size_t v = 0; v < num_vertices; v++) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+
+  std::vector<uint32_t> adjacency(num_indices);
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < num_indices; i++) {
+    adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+  }
+
+  std::vector<int> cache_position(num_vertices, -1);
+  std::vector<float> vscore(num_vertices);
+  for (size_t v = 0; v < num_vertices; v++) {
+    vscore[v] = vertex_score(-1, remaining[v]);
+  }
+
+  std::vector<float> tscore(num_triangles);
+  std::vector<uint8_t> emitted(num_triangles, 0);
+  uint32_t best = 0;
+  for (size_t t = 0; t < num_triangles; t++) {
+    tscore[t] = vscore[indices[t * 3]] + vscore[indices[t * 3 + 1]] + vscore[indices[t * 3 + 2]];
+    if (tscore[t] > tscore[best]) {
+      best = (uint32_t)t;
+    }
+  }
+
+  std::vector<uint32_t> output(num_indices);
+  uint32_t cache[VertexCacheSize + 3];
+  int cache_count = 0;
+  size_t scan_cursor = 0;
+
+  for (size_t out_tri = 0; out_tri < num_triangles; out_tri++) {
+    if (best == NoIndex) {
+      // Nothing in the cache has triangles left, continue from the next unemitted one.
+      while (emitted[scan_cursor]) {
+        scan_cursor++;
+      }
+      best = (uint32_t)scan_cursor;
+    }
+
+    const uint32_t* tri = indices + (size_t)best * 3;
+    memcpy(output.data() + out_tri * 3, tri, 3 * sizeof(uint32_t));
+    emitted[best] = 1;
+
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = tri[k];
+      uint32_t* list = adjacency.data() + offsets[v];
+      uint32_t count = remaining[v];
+      for (uint32_t j = 0; j < count; j++) {
+        if (list[j] == best) {
+          list[j] = list[count - 1];
+          break;
+        }
+      }
+      remaining[v] = count - 1;
+    }
+
+    // New LRU state: the emitted triangle first, then the previous entries.
+    uint32_t next_cache[VertexCacheSize + 3];
+    int next_count = 0;
+    for (int k = 0; k < 3; k++) {
+      next_cache[next_count++] = tri[k];
+    }
+    for (int i = 0; i < cache_count; i++) {
+      uint32_t v = cache[i];
+      if (v != tri[0] && v != tri[1] && v != tri[2]) {
+        next_cache[next_count++] = v;
+      }
+    }
+
+    for (int i = 0; i < next_count; i++) {
+      uint32_t v = next_cache[i];
+      cache_position[v] = i < VertexCacheSize ? i : -1;
+      vscore[v] = vertex_score(cache_position[v], remaining[v]);
+    }
+
+    best = NoIndex;
+    float best_score = -1.0f;
+    for (int i = 0; i < next_count; i++) {
+      uint32_t v = next_cache[i];
+      const uint32_t* list = adjacency.data() + offsets[v];
+      for (uint32_t j = 0; j < remaining[v]; j++) {
+        uint32_t t = list[j];
+        const uint32_t* tv = indices + (size_t)t * 3;
+        tscore[t] = vscore[tv[0]] + vscore[tv[1]] + vscore[tv[2]];
+        if (tscore[t] > best_score) {
+          best_score = tscore[t];
+          best = t;
+        }
+      }
+    }
+
+    cache_count = next_count < VertexCacheSize ? next_count : VertexCacheSize;
+    memcpy(cache, next_cache, cache_count * sizeof(uint32_t));
+  }
+
+  memcpy(indices, output.data(), num_indices * sizeof(uint32_t));
+}
+
+bool Mesh::Build(const ufbx_mesh* mesh) {
+  name.assign(mesh->name.data, mesh->name.length);
+
+  // One vertex per triangle corner, zeroed since ufbx_generate_indices() compares with memcmp().
+  size_t max_corners = mesh->num_triangles * 3;
+  std::vector<Vertex> corners(max_corners, Vertex{});
+  std::vector<uint32_t> corner_ids(max_corners);
+  std::vector<uint32_t> triangle(mesh->max_face_triangles * 3);
+
+  bool has_normals = mesh->vertex_normal.exists;
+  bool has_uvs = mesh->vertex_uv.exists;
+
+  size_t num_corners = 0;
+  for (const ufbx_face& face : mesh->faces) {
+    uint32_t num_triangles = ufbx_triangulate_face(triangle.data(), triangle.size(), mesh, face);
+    for (uint32_t i = 0; i < num_triangles * 3; i++) {
+      uint32_t index = triangle[i];
+      Vertex& v = corners[num_corners];
+
+      ufbx_vec3 position = ufbx_get_vertex_vec3(&mesh->vertex_position, index);
+      v.position[0] = (float)position.x;
+      v.position[1] = (float)position.y;
+      v.position[2] = (float)position.z;
+
+      if (has_normals) {
+        ufbx_vec3 normal = ufbx_get_vertex_vec3(&mesh->vertex_normal, index);
+        v.normal[0] = (float)normal.x;
+        v.normal[1] = (float)normal.y;
+        v.normal[2] = (float)normal.z;
+      }
+
+      if (has_uvs) {
+        ufbx_vec2 uv = ufbx_get_vertex_vec2(&mesh->vertex_uv, index);
+        v.uv[0] = (float)uv.x;
+        v.uv[1] = (float)uv.y;
+      }
+
+      // Part of the key so corners of different control points never merge, skinning needs them apart.
+      corner_ids[num_corners] = mesh->vertex_indices[index];
+      num_corners++;
+    }
+  }
+
+  ufbx_vertex_stream streams[2] = {
+    { corners.data(), num_corners, sizeof(Vertex) },
+    { corner_ids.data(), num_corners, sizeof(uint32_t) },
+  };
+
+  std::vector<uint32_t> indices(num_corners);
+  ufbx_error error;
+  size_t num_vertices = ufbx_generate_indices(streams, 2, indices.data(), num_corners, nullptr, &error);
+  if (error.type != UFBX_ERROR_NONE) {
+    fprintf(stderr, "Failed to generate indices for %s: %s\n", name.c_str(), error.description.data);
+    return false;
+  }
+
+  stats_before = analyze_vertex_cache(indices.data(), num_corners, num_vertices);
+  optimize_vertex_cache(indices.data(), num_corners, num_vertices);
+
+  // Renumber vertices in first-use order so vertex fetch walks memory forwards.
+  std::vector<uint32_t> remap(num_vertices, NoIndex);
+  uint32_t next_vertex = 0;
+  for (uint32_t& index : indices) {
+    if (remap[index] == NoIndex) {
+      remap[index] = next_vertex++;
+    }
+    index = remap[index];
+  }
+
+  vertices.resize(next_vertex);
+  vertex_ids.resize(next_vertex);
+  bounds = Aabb();
+  for (size_t v = 0; v < num_vertices; v++) {
+    if (remap[v] != NoIndex) {
+      vertices[remap[v]] = corners[v];
+      vertex_ids[remap[v]] = corner_ids[v];
+      bounds.Add(corners[v].position);
+    }
+  }
+
+  stats_after = analyze_vertex_cache(indices.data(), num_corners, next_vertex);
+
+  if (next_vertex <= UINT16_MAX) {
+    index_size = 2;
+    index_data.resize(num_corners * 2);
+    uint16_t* out = (uint16_t*)index_data.data();
+    for (size_t i = 0; i < num_corners; i++) {
+      out[i] = (uint16_t)indices[i];
+    }
+  } else {
+    index_size = 4;
+    index_data.resize(num_corners * 4);
+    memcpy(index_data.data(), indices.data(), num_corners * 4);
+  }
+
+  return true;
+}
+
+MeshView Mesh::View() const {
+  MeshView view;
+  view.vertices = vertices.data();
+  view.num_vertices = vertices.size();
+  view.indices = index_data.data();
+  view.num_indices = NumIndices();
+  view.index_size = index_size;
+  view.skin = skin;
+  view.texture = texture;
+  view.bounds = bounds;
+  return view;
+}
+
+void GpuMesh::Upload(const MeshView& view, GLenum usage) {
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &vbo);
+  glGenBuffers(1, &ebo);
+
+  glBindVertexArray(vao);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, view.num_vertices * sizeof(Vertex), view.vertices, usage);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, view.num_indices * view.index_size, view.indices, GL_STATIC_DRAW);
+  BONES_COUNT(ProfileCounter::BytesUploaded, view.num_vertices * sizeof(Vertex) + view.num_indices * view.index_size);
+
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(2);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  index_count = (GLsizei)view.num_indices;
+  index_type = view.index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+void GpuMesh::UpdateVertices(const Vertex* vertices, size_t num_vertices) {
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_vertices * sizeof(Vertex), vertices);
+  BONES_COUNT(ProfileCounter::BytesUploaded, num_vertices * sizeof(Vertex));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GpuMesh::Draw() const {
+  glBindVertexArray(vao);
+  glDrawElements(GL_TRIANGLES, index_count, index_type, 0);
+  BONES_COUNT(ProfileCounter::DrawCalls, 1);
+  BONES_COUNT(ProfileCounter::Triangles, index_count / 3);
+}
+
+void GpuMesh::Destroy() {
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &vbo);
+  glDeleteBuffers(1, &ebo);
+  vao = vbo = ebo = 0;
+}
@@ -1,5 +1,77 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "culling.h"
+#include "ufbx.h"
+
+struct Vertex {
+  float position[3];
+  float normal[3];
+  float uv[2];
+};
+
+// Post-transform cache statistics of an index buffer, simulated as a FIFO.
+// ACMR is transformed vertices per triangle, ATVR per unique vertex (1.0 is ideal).
+struct VertexCacheStats {
+  float acmr = 0.0f;
+  float atvr = 0.0f;
+};
+
+// Non-owning geometry of one mesh, backed either by a Mesh or by a mapped cache.
+struct MeshView {
+  const Vertex* vertices = nullptr;
+  size_t num_vertices = 0;
+  const void* indices = nullptr;
+  size_t num_indices = 0;
+  uint32_t index_size = 4;
+  int32_t skin = -1;
+  int32_t texture = -1; // into ModelData::textures
+  Aabb bounds;          // of the bind pose vertices
+};
+
 class Mesh {
-  //
+public:
+  // Triangulates, deduplicates and reorders the triangles and vertices of mesh
+  // for vertex cache and fetch locality. Indices are 16-bit when they fit.
+  bool Build(const ufbx_mesh* mesh);
+
+  MeshView View() const;
+  size_t NumIndices() const { return index_data.size() / index_size; }
+
+  std::string name;
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> vertex_ids; // ufbx control point of every vertex
+  std::vector<uint8_t> index_data;
+  uint32_t index_size = 4;
+  int32_t skin = -1;
+  int32_t texture = -1;
+  Aabb bounds;
+
+  VertexCacheStats stats_before;
+  VertexCacheStats stats_after;
+};
+
+VertexCacheStats analyze_vertex_cache(const uint32_t* indices, size_t num_indices, size_t num_vertices);
+
+// Forsyth's linear-speed vertex cache optimisation, reorders triangles in place.
+void optimize_vertex_cache(uint32_t* indices, size_t num_indices, size_t num_vertices);
+
+struct GpuMesh {
+  GLuint vao = 0;
+  GLuint vbo = 0;
+  GLuint ebo = 0;
+  GLsizei index_count = 0;
+  GLenum index_type = GL_UNSIGNED_INT;
+
+  void Upload(const MeshView& view, GLenum usage = GL_STATIC_DRAW);
+  // Rewrites the vertex buffer in place, used for CPU-skinned meshes.
+  void UpdateVertices(const Vertex* vertices, size_t num_vertices);
+  void Draw() const;
+  void Destroy();
 };
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov). Push is
+// wait-free and may be called from any thread, TryPop only from the consumer.
+template <typename T>
+class MpscQueue {
+public:
+  MpscQueue() : head(&stub), tail(&stub) {}
+
+  ~MpscQueue() {
+    T value;
+    while (TryPop(value)) {
+    }
+    if (tail != &stub) {
+      delete tail;
+    }
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  void Push(T value) {
+    Node* node = new Node;
+    node->value = std::move(value);
+    Node* prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  bool TryPop(T& out) {
+    Node* first = tail;
+    Node* next = first->next.load(std::memory_order_acquire);
+    if (!next) {
+      // Empty, or a producer is between the exchange and linking its node.
+      return false;
+    }
+
+    out = std::move(next->value);
+    tail = next;
+    if (first != &stub) {
+      delete first;
+    }
+    return true;
+  }
+
+private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    T value{};
+  };
+
+  // The node tail points at is always consumed, next holds the front value.
+  Node stub;
+  std::atomic<Node*> head;
+  Node* tail;
+};
@@ -0,0 +1,424 @@
+#include "profiler.h"
+
+#if defined(BONES_PROFILER)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <GL/glew.h>
+
+namespace {
+
+constexpr size_t ZoneCapacity = (size_t)1 << 16; // per thread, a longer capture loses its oldest zones
+constexpr int MaxGpuZones = 256;                  // per frame
+constexpr int GpuQuerySets = 2;
+constexpr size_t CounterCapacity = 4096;          // frames reserved for up front
+constexpr int NumCounters = (int)ProfileCounter::Count;
+
+const char* const CounterNames[NumCounters] = {"draw calls", "triangles", "bytes uploaded", "allocations"};
+
+struct ZoneEvent {
+  const char* name;
+  uint64_t start_ns;
+  uint64_t end_ns;
+};
+
+// A ring slot. Fields are relaxed atomics so the capture may copy a slot while its
+// thread overwrites it, copies the writer may have lapped are then thrown away.
+struct ZoneSlot {
+  std::atomic<const char*> name{nullptr};
+  std::atomic<uint64_t> start_ns{0};
+  std::atomic<uint64_t> end_ns{0};
+};
+
+// Written only by its thread, read by the capture up to the published write index.
+struct ThreadBuffer {
+  uint32_t id = 0;
+  char name[32] = {};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> counters[NumCounters] = {};
+
+  // Touched only by the GL thread in profiler_frame() and the capture calls.
+  uint64_t folded[NumCounters] = {};
+  uint64_t capture_start = 0;
+
+  ZoneSlot events[ZoneCapacity];
+};
+
+struct GpuQuerySet {
+  GLuint queries[MaxGpuZones * 2] = {};
+  const char* names[MaxGpuZones] = {};
+  int count = 0;
+};
+
+struct CounterSample {
+  uint64_t time_ns;
+  ProfileCounters counters;
+};
+
+std::mutex registry_mutex;
+std::atomic<uint32_t> next_thread_id{1};
+std::atomic<bool> capturing{false};
+std::atomic<uint64_t> unregistered_allocations{0};
+thread_local ThreadBuffer* current_thread = nullptr;
+
+// Buffers outlive their threads, so a capture still has the zones of a finished worker.
+std::vector<ThreadBuffer*>& registry() {
+  static std::vector<ThreadBuffer*> buffers;
+  return buffers;
+}
+
+GpuQuerySet gpu_sets[GpuQuerySets];
+int gpu_set = 0;
+bool gpu_created = false;
+int64_t gpu_to_cpu_ns = 0;
+
+uint64_t capture_origin_ns = 0;
+uint64_t folded_unregistered = 0;
+ProfileCounters frame_counters;
+std::vector<ZoneEvent> gpu_events;
+std::vector<CounterSample> counter_samples;
+
+uint64_t now_ns() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ThreadBuffer* thread_buffer() {
+  if (!current_thread) {
+    ThreadBuffer* buffer = new ThreadBuffer();
+    buffer->id = next_thread_id.fetch_add(1, std::memory_order_relaxed);
+    snprintf(buffer->name, sizeof(buffer->name), "thread %u", buffer->id);
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry().push_back(buffer);
+    current_thread = buffer;
+  }
+  return current_thread;
+}
+
+// Single writer, so a plain load and store is enough for the reader to see whole values.
+void add_counter(std::atomic<uint64_t>& counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void count_allocation() {
+  if (ThreadBuffer* buffer = current_thread) {
+    add_counter(buffer->counters[(int)ProfileCounter::Allocations], 1);
+  } else {
+    unregistered_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void calibrate_gpu_clock() {
+  GLint64 gpu_now = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+  gpu_to_cpu_ns = (int64_t)now_ns() - (int64_t)gpu_now;
+}
+
+void read_gpu_set(GpuQuerySet& set) {
+  for (int i = 0; i < set.count; i++) {
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(set.queries[i * 2], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(set.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+    if (capturing.load(std::memory_order_relaxed)) {
+      gpu_events.push_back({set.names[i], (uint64_t)((int64_t)start + gpu_to_cpu_ns), (uint64_t)((int64_t)end + gpu_to_cpu_ns)});
+    }
+  }
+  set.count = 0;
+}
+
+double trace_us(uint64_t time_ns) {
+  return (double)((int64_t)time_ns - (int64_t)capture_origin_ns) * 1e-3;
+}
+
+void write_zone(FILE* file, const ZoneEvent& event, uint32_t tid, bool& first) {
+  fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+      first ? "" : ",\n", event.name, tid, trace_us(event.start_ns), (double)(event.end_ns - event.start_ns) * 1e-3);
+  first = false;
+}
+
+} // namespace
+
+ProfileZone::ProfileZone(const char* name) : name(name), start_ns(capturing.load(std::memory_order_relaxed) ? now_ns() : 0) {}
+
+ProfileZone::~ProfileZone() {
+  if (start_ns == 0) {
+    return;
+  }
+  ThreadBuffer* buffer = thread_buffer();
+  uint64_t index = buffer->written.load(std::memory_order_relaxed);
+  // Orders the slot writes after the last published index, a capture that sees
+  // any of them then also sees written >= index (a seqlock without the odd count).
+  std::atomic_thread_fence(std::memory_order_release);
+  ZoneSlot& slot = buffer->events[index % ZoneCapacity];
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start_ns.store(start_ns, std::memory_order_relaxed);
+  slot.end_ns.store(now_ns(), std::memory_order_relaxed);
+  buffer->written.store(index + 1, std::memory_order_release);
+}
+
+GpuProfileZone::GpuProfileZone(const char* name) : index(-1) {
+  GpuQuerySet& set = gpu_sets[gpu_set];
+  if (!gpu_created || !capturing.load(std::memory_order_relaxed) || set.count >= MaxGpuZones) {
+    return;
+  }
+  // The set is part of the index, so a zone that straddles profiler_frame() ends in its own set.
+  int slot = set.count++;
+  set.names[slot] = name;
+  glQueryCounter(set.queries[slot * 2], GL_TIMESTAMP);
+  index = gpu_set * MaxGpuZones + slot;
+}
+
+GpuProfileZone::~GpuProfileZone() {
+  if (index >= 0) {
+    glQueryCounter(gpu_sets[index / MaxGpuZones].queries[(index % MaxGpuZones) * 2 + 1], GL_TIMESTAMP);
+  }
+}
+
+void profiler_count(ProfileCounter counter, uint64_t value) {
+  add_counter(thread_buffer()->counters[(int)counter], value);
+}
+
+void profiler_set_thread_name(const char* name) {
+  ThreadBuffer* buffer = thread_buffer();
+  snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+}
+
+void profiler_create_gpu() {
+  if (gpu_created) {
+    return;
+  }
+  for (GpuQuerySet& set : gpu_sets) {
+    glGenQueries(MaxGpuZones * 2, set.queries);
+    set.count = 0;
+  }
+  calibrate_gpu_clock();
+  gpu_created = true;
+}
+
+void profiler_destroy_gpu() {
+  if (!gpu_created) {
+    return;
+  }
+  for (GpuQuerySet& set : gpu_sets) {
+    glDeleteQueries(MaxGpuZones * 2, set.queries);
+    set.count = 0;
+  }
+  gpu_created = false;
+}
+
+void profiler_frame() {
+  if (gpu_created) {
+    gpu_set = (gpu_set + 1) % GpuQuerySets;
+    read_gpu_set(gpu_sets[gpu_set]);
+  }
+
+  ProfileCounters totals;
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (ThreadBuffer* buffer : registry()) {
+      for (int c = 0; c < NumCounters; c++) {
+        uint64_t value = buffer->counters[c].load(std::memory_order_relaxed);
+        totals.values[c] += value - buffer->folded[c];
+        buffer->folded[c] = value;
+      }
+    }
+  }
+  uint64_t unregistered = unregistered_allocations.load(std::memory_order_relaxed);
+  totals.values[(int)ProfileCounter::Allocations] += unregistered - folded_unregistered;
+  folded_unregistered = unregistered;
+  frame_counters = totals;
+
+  if (capturing.load(std::memory_order_relaxed)) {
+    counter_samples.push_back({now_ns(), totals});
+  }
+}
+
+const ProfileCounters& profiler_frame_counters() {
+  return frame_counters;
+}
+
+void profiler_begin_capture() {
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (ThreadBuffer* buffer : registry()) {
+      buffer->capture_start = buffer->written.load(std::memory_order_acquire);
+    }
+  }
+
+  // Reserved here so recording adds no allocations of its own to the frames it measures.
+  gpu_events.clear();
+  gpu_events.reserve((size_t)MaxGpuZones * 64);
+  counter_samples.clear();
+  counter_samples.reserve(CounterCapacity);
+  if (gpu_created) {
+    calibrate_gpu_clock();
+  }
+  capture_origin_ns = now_ns();
+  capturing.store(true, std::memory_order_relaxed);
+}
+
+bool profiler_capturing() {
+  return capturing.load(std::memory_order_relaxed);
+}
+
+bool profiler_end_capture(const char* path) {
+  // Both sets may still hold zones of the last frames.
+  if (gpu_created) {
+    for (int i = 1; i <= GpuQuerySets; i++) {
+      read_gpu_set(gpu_sets[(gpu_set + i) % GpuQuerySets]);
+    }
+  }
+  capturing.store(false, std::memory_order_relaxed);
+
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return false;
+  }
+
+  std::vector<ThreadBuffer*> buffers;
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    buffers = registry();
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  size_t num_zones = 0;
+  uint64_t dropped = 0;
+  std::vector<ZoneEvent> zones;
+  zones.reserve(ZoneCapacity);
+  for (ThreadBuffer* buffer : buffers) {
+    // Threads may still be recording. Copy the ring out, then drop every copy
+    // whose slot the thread may have reused meanwhile, including the one it
+    // could be writing right now.
+    uint64_t end = buffer->written.load(std::memory_order_acquire);
+    uint64_t begin = std::max(buffer->capture_start, end > ZoneCapacity ? end - ZoneCapacity : 0);
+    zones.clear();
+    for (uint64_t i = begin; i < end; i++) {
+      const ZoneSlot& slot = buffer->events[i % ZoneCapacity];
+      zones.push_back({slot.name.load(std::memory_order_relaxed), slot.start_ns.load(std::memory_order_relaxed),
+                       slot.end_ns.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t lapped = buffer->written.load(std::memory_order_relaxed) + 1;
+    uint64_t valid = std::max(begin, lapped > ZoneCapacity ? std::min(lapped - ZoneCapacity, end) : 0);
+    dropped += valid - std::min(buffer->capture_start, valid);
+    if (valid == end) {
+      continue;
+    }
+
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",\n", buffer->id, buffer->name);
+    first = false;
+    for (uint64_t i = valid; i < end; i++) {
+      write_zone(file, zones[(size_t)(i - begin)], buffer->id, first);
+    }
+    num_zones += (size_t)(end - valid);
+  }
+
+  if (!gpu_events.empty()) {
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}", first ? "" : ",\n");
+    first = false;
+    for (const ZoneEvent& event : gpu_events) {
+      write_zone(file, event, 0, first);
+    }
+  }
+
+  for (const CounterSample& sample : counter_samples) {
+    for (int c = 0; c < NumCounters; c++) {
+      fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%llu}}",
+          first ? "" : ",\n", CounterNames[c], trace_us(sample.time_ns), (unsigned long long)sample.counters.values[c]);
+      first = false;
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return false;
+  }
+
+  printf("Wrote %s: %zu CPU zones on %zu threads, %zu GPU zones, %zu frames of counters",
+      path, num_zones, buffers.size(), gpu_events.size(), counter_samples.size());
+  if (dropped > 0) {
+    printf(", %llu oldest zones overwritten", (unsigned long long)dropped);
+  }
+  printf("\n");
+  return true;
+}
+
+// Counting replacements of the global allocation functions, so the allocations
+// counter sees every operator new in the process.
+namespace {
+
+void* allocate(size_t size) {
+  count_allocation();
+  void* memory = malloc(size > 0 ? size : 1);
+  if (!memory) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void* allocate_aligned(size_t size, std::align_val_t alignment) {
+  count_allocation();
+  void* memory = nullptr;
+#if defined(_MSC_VER)
+  memory = _aligned_malloc(size > 0 ? size : 1, (size_t)alignment);
+#else
+  if (posix_memalign(&memory, (size_t)alignment, size > 0 ? size : 1) != 0) {
+    memory = nullptr;
+  }
+#endif
+  if (!memory) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void release_aligned(void* memory) {
+#if defined(_MSC_VER)
+  _aligned_free(memory);
+#else
+  free(memory);
+#endif
+}
+
+} // namespace
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  count_allocation();
+  return malloc(size > 0 ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  count_allocation();
+  return malloc(size > 0 ? size : 1);
+}
+void* operator new(size_t size, std::align_val_t alignment) { return allocate_aligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocate_aligned(size, alignment); }
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { release_aligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { release_aligned(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { release_aligned(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { release_aligned(memory); }
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Frame profiler: scoped CPU zones, GPU zones and per-frame counters, captured
+// over a stretch of frames and written out as Chrome trace JSON (chrome://tracing,
+// Perfetto). Built with BONES_PROFILER, otherwise every macro and function below
+// compiles to nothing.
+//
+// CPU zones go into a ring per thread that only its own thread writes, so
+// recording takes no lock. GPU zones are GL_TIMESTAMP query pairs in two sets
+// that alternate per frame, a set is read back one frame after it was issued.
+
+enum class ProfileCounter {
+  DrawCalls,
+  Triangles,
+  BytesUploaded, // buffer and texture data handed to GL
+  Allocations,   // operator new calls, on any thread
+  Count,
+};
+
+struct ProfileCounters {
+  uint64_t values[(int)ProfileCounter::Count] = {};
+
+  uint64_t operator[](ProfileCounter counter) const { return values[(int)counter]; }
+};
+
+#if defined(BONES_PROFILER)
+
+#define BONES_PROFILE_CONCAT_(a, b) a##b
+#define BONES_PROFILE_CONCAT(a, b) BONES_PROFILE_CONCAT_(a, b)
+
+// name must be a string literal, only the pointer is kept.
+#define BONES_ZONE(name) ProfileZone BONES_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define BONES_GPU_ZONE(name) GpuProfileZone BONES_PROFILE_CONCAT(gpu_profile_zone_, __LINE__)(name)
+#define BONES_COUNT(counter, value) profiler_count(counter, (uint64_t)(value))
+
+class ProfileZone {
+public:
+  explicit ProfileZone(const char* name);
+  ~ProfileZone();
+
+  ProfileZone(const ProfileZone&) = delete;
+  ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+  const char* name;
+  uint64_t start_ns;
+};
+
+// GL thread only, nests like ProfileZone.
+class GpuProfileZone {
+public:
+  explicit GpuProfileZone(const char* name);
+  ~GpuProfileZone();
+
+  GpuProfileZone(const GpuProfileZone&) = delete;
+  GpuProfileZone& operator=(const GpuProfileZone&) = delete;
+
+private:
+  int index;
+};
+
+void profiler_count(ProfileCounter counter, uint64_t value);
+
+// Names the calling thread in traces.
+void profiler_set_thread_name(const char* name);
+
+// Creates and destroys the timestamp queries, on the GL thread with a context current.
+// Without them GPU zones are ignored.
+void profiler_create_gpu();
+void profiler_destroy_gpu();
+
+// Ends a frame on the GL thread: swaps the GPU query sets, reads back the older
+// one and folds the counters of every thread into the frame's totals.
+void profiler_frame();
+
+// Counters of the last frame profiler_frame() ended.
+const ProfileCounters& profiler_frame_counters();
+
+// Starts recording zones and counters, on the GL thread like the rest below.
+void profiler_begin_capture();
+bool profiler_capturing();
+
+// Stops recording and writes everything since profiler_begin_capture() to path.
+// Other threads need not be idle, zones they have yet to close are left out.
+bool profiler_end_capture(const char* path);
+
+#else
+
+#define BONES_ZONE(name) ((void)0)
+#define BONES_GPU_ZONE(name) ((void)0)
+#define BONES_COUNT(counter, value) ((void)0)
+
+inline void profiler_set_thread_name(const char*) {}
+inline void profiler_create_gpu() {}
+inline void profiler_destroy_gpu() {}
+inline void profiler_frame() {}
+inline const ProfileCounters& profiler_frame_counters() {
+  static const ProfileCounters none;
+  return none;
+}
+inline void profiler_begin_capture() {}
+inline bool profiler_capturing() { return false; }
+inline bool profiler_end_capture(const char*) { return false; }
+
+#endif
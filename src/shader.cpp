@@ -0,0 +1,145 @@
+#include "shader.h"
+
+#include <cstdio>
+
+const char* const MeshVertexShader = R"(
+  #version 330 core
+  layout (location = 0) in vec3 aPos;
+  layout (location = 1) in vec3 aColor;
+  layout (location = 2) in vec2 aTex;
+
+  out vec3 color;
+  out vec2 texCoord;
+
+  uniform float scale;
+
+  layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+  };
+
+  layout (std140) uniform ObjectData {
+    mat4 model;
+  };
+
+  void main() {
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    color = aColor;
+    texCoord = aTex;
+  }
+)";
+
+const char* const MeshFragmentShader = R"(
+  #version 330 core
+  out vec4 FragColor;
+
+  in vec3 color;
+  in vec2 texCoord;
+
+  uniform sampler2D tex0;
+
+  void main() {
+    FragColor = texture(tex0, texCoord);
+  }
+)";
+
+const char* const CrowdVertexShader = R"(
+  #version 330 core
+  layout (location = 0) in vec3 aPos;
+  layout (location = 1) in vec3 aColor;
+  layout (location = 2) in vec2 aTex;
+  layout (location = 3) in uvec4 aBones;
+  layout (location = 4) in vec4 aWeights;
+  layout (location = 5) in mat4 aInstance;
+  layout (location = 9) in uint aPaletteBase;
+
+  out vec3 color;
+  out vec2 texCoord;
+
+  layout (std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+  };
+
+  // Four RGBA32F texels per bone matrix, one palette per instance.
+  uniform samplerBuffer palettes;
+  uniform int paletteOffset;
+
+  mat4 bone(uint index) {
+    int texel = (int(aPaletteBase) + paletteOffset + int(index)) * 4;
+    return mat4(
+      texelFetch(palettes, texel),
+      texelFetch(palettes, texel + 1),
+      texelFetch(palettes, texel + 2),
+      texelFetch(palettes, texel + 3));
+  }
+
+  void main() {
+    mat4 skin = bone(aBones.x) * aWeights.x
+              + bone(aBones.y) * aWeights.y
+              + bone(aBones.z) * aWeights.z
+              + bone(aBones.w) * aWeights.w;
+    gl_Position = projection * view * aInstance * skin * vec4(aPos, 1.0);
+    color = aColor;
+    texCoord = aTex;
+  }
+)";
+
+namespace {
+
+GLuint compile_shader(GLenum type, const char* source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+
+  GLint status = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (status != GL_TRUE) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    fprintf(stderr, "Failed to compile %s shader: %s\n", type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+} // namespace
+
+GLuint build_program(const char* vertex_source, const char* fragment_source) {
+  GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
+  GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+  if (!vertex_shader || !fragment_shader) {
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glAttachShader(program, vertex_shader);
+  glAttachShader(program, fragment_shader);
+  glLinkProgram(program);
+
+  glDeleteShader(vertex_shader);
+  glDeleteShader(fragment_shader);
+
+  GLint status = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    char log[1024];
+    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    fprintf(stderr, "Failed to link program: %s\n", log);
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  GLuint frame_block = glGetUniformBlockIndex(program, "FrameData");
+  if (frame_block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program, frame_block, FrameBlockBinding);
+  }
+  GLuint object_block = glGetUniformBlockIndex(program, "ObjectData");
+  if (object_block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program, object_block, ObjectBlockBinding);
+  }
+  return program;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// std140 uniform blocks shared by every program, bound to fixed binding points at link time.
+constexpr GLuint FrameBlockBinding = 0;
+constexpr GLuint ObjectBlockBinding = 1;
+
+struct FrameUniforms {
+  float view[16];
+  float projection[16];
+};
+
+struct ObjectUniforms {
+  float model[16];
+};
+
+// Textured mesh shader, attribute locations match GpuMesh.
+extern const char* const MeshVertexShader;
+extern const char* const MeshFragmentShader;
+
+// Instanced, GPU-skinned variant of MeshVertexShader used by CrowdRenderer.
+extern const char* const CrowdVertexShader;
+
+// Compiles and links a program and binds its FrameData/ObjectData blocks,
+// prints the info log and returns 0 on failure.
+GLuint build_program(const char* vertex_source, const char* fragment_source);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ufbx.h"
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+  #define BONES_SSE 1
+  #define BONES_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define BONES_SSE 1
+#endif
+
+// Matrices are 16 floats, column-major, the same layout as glm::mat4 and glUniformMatrix4fv.
+
+inline void mat4_from_ufbx(const ufbx_matrix& m, float* out) {
+  for (int c = 0; c < 4; c++) {
+    out[c * 4 + 0] = (float)m.cols[c].x;
+    out[c * 4 + 1] = (float)m.cols[c].y;
+    out[c * 4 + 2] = (float)m.cols[c].z;
+    out[c * 4 + 3] = c == 3 ? 1.0f : 0.0f;
+  }
+}
+
+inline void mat4_identity(float* out) {
+  for (int i = 0; i < 16; i++) {
+    out[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+  }
+}
+
+// Local transform T * R * S, r is a unit quaternion xyzw.
+inline void mat4_from_trs(const float* t, const float* r, const float* s, float* out) {
+  float x = r[0], y = r[1], z = r[2], w = r[3];
+  out[0]  = (1.0f - 2.0f * (y * y + z * z)) * s[0];
+  out[1]  = (2.0f * (x * y + z * w)) * s[0];
+  out[2]  = (2.0f * (x * z - y * w)) * s[0];
+  out[3]  = 0.0f;
+  out[4]  = (2.0f * (x * y - z * w)) * s[1];
+  out[5]  = (1.0f - 2.0f * (x * x + z * z)) * s[1];
+  out[6]  = (2.0f * (y * z + x * w)) * s[1];
+  out[7]  = 0.0f;
+  out[8]  = (2.0f * (x * z + y * w)) * s[2];
+  out[9]  = (2.0f * (y * z - x * w)) * s[2];
+  out[10] = (1.0f - 2.0f * (x * x + y * y)) * s[2];
+  out[11] = 0.0f;
+  out[12] = t[0];
+  out[13] = t[1];
+  out[14] = t[2];
+  out[15] = 1.0f;
+}
+
+// out = a * b, out may not alias a or b.
+inline void mat4_mul(const float* a, const float* b, float* out) {
+#if defined(BONES_AVX2)
+  // Two output columns per iteration, each 128-bit lane works on one of them.
+  __m256 a0 = _mm256_broadcast_ps((const __m128*)(a + 0));
+  __m256 a1 = _mm256_broadcast_ps((const __m128*)(a + 4));
+  __m256 a2 = _mm256_broadcast_ps((const __m128*)(a + 8));
+  __m256 a3 = _mm256_broadcast_ps((const __m128*)(a + 12));
+  for (int c = 0; c < 4; c += 2) {
+    __m256 bc = _mm256_loadu_ps(b + c * 4);
+    __m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+    r = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1)), r);
+    r = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2)), r);
+    r = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(bc, bc, _MM_SHUFFLE(3, 3, 3, 3)), r);
+    _mm256_storeu_ps(out + c * 4, r);
+  }
+#elif defined(BONES_SSE)
+  __m128 a0 = _mm_loadu_ps(a + 0);
+  __m128 a1 = _mm_loadu_ps(a + 4);
+  __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 a3 = _mm_loadu_ps(a + 12);
+  for (int c = 0; c < 4; c++) {
+    const float* bc = b + c * 4;
+    __m128 r = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+    _mm_storeu_ps(out + c * 4, r);
+  }
+#else
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 4; r++) {
+      out[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+    }
+  }
+#endif
+}
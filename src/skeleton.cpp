@@ -0,0 +1,133 @@
+#include "skeleton.h"
+
+#include <cstring>
+
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace {
+
+constexpr uint32_t NoJoint = UINT32_MAX;
+constexpr size_t BatchInstances = 16;
+
+} // namespace
+
+bool Skeleton::Build(const ufbx_scene* scene) {
+  size_t num_nodes = scene->nodes.count;
+  parents.clear();
+  joint_nodes.clear();
+  parents.reserve(num_nodes);
+  joint_nodes.reserve(num_nodes);
+
+  // Depth first from every root, children pushed in reverse so they keep their scene order.
+  std::vector<const ufbx_node*> stack;
+  std::vector<uint32_t> joints(num_nodes, NoJoint);
+  for (const ufbx_node* root : scene->nodes) {
+    if (root->parent) {
+      continue;
+    }
+    stack.push_back(root);
+    while (!stack.empty()) {
+      const ufbx_node* node = stack.back();
+      stack.pop_back();
+
+      joints[node->typed_id] = (uint32_t)joint_nodes.size();
+      joint_nodes.push_back(node->typed_id);
+      parents.push_back(node->parent ? (int32_t)joints[node->parent->typed_id] : -1);
+      for (size_t i = node->children.count; i > 0; i--) {
+        stack.push_back(node->children.data[i - 1]);
+      }
+    }
+  }
+
+  size_t num_joints = joint_nodes.size();
+  rest.Resize(num_joints);
+  inverse_bind.resize(num_joints * 16);
+  for (size_t j = 0; j < num_joints; j++) {
+    const ufbx_node* node = scene->nodes.data[joint_nodes[j]];
+    const ufbx_transform& local = node->local_transform;
+    for (int k = 0; k < 3; k++) {
+      rest.translations[j * 3 + k] = (float)local.translation.v[k];
+      rest.scales[j * 3 + k] = (float)local.scale.v[k];
+    }
+    for (int k = 0; k < 4; k++) {
+      rest.rotations[j * 4 + k] = (float)local.rotation.v[k];
+    }
+
+    ufbx_matrix world_to_node = ufbx_matrix_invert(&node->node_to_world);
+    mat4_from_ufbx(world_to_node, inverse_bind.data() + j * 16);
+  }
+
+  // Bones are bound where the skin says, which need not be their rest pose.
+  for (const ufbx_skin_cluster* cluster : scene->skin_clusters) {
+    if (cluster->bone_node && joints[cluster->bone_node->typed_id] != NoJoint) {
+      ufbx_matrix world_to_bind = ufbx_matrix_invert(&cluster->bind_to_world);
+      mat4_from_ufbx(world_to_bind, inverse_bind.data() + (size_t)joints[cluster->bone_node->typed_id] * 16);
+    }
+  }
+
+  return Finish();
+}
+
+bool Skeleton::Finish() {
+  size_t num_joints = parents.size();
+  if (joint_nodes.size() != num_joints || rest.NumJoints() != num_joints || inverse_bind.size() != num_joints * 16) {
+    return false;
+  }
+
+  node_joints.assign(num_joints, NoJoint);
+  for (size_t j = 0; j < num_joints; j++) {
+    if (parents[j] >= (int32_t)j || joint_nodes[j] >= num_joints || node_joints[joint_nodes[j]] != NoJoint) {
+      return false;
+    }
+    node_joints[joint_nodes[j]] = (uint32_t)j;
+  }
+
+  rest_model.resize(num_joints * 16);
+  local_to_model(*this, rest, rest_model.data());
+  return true;
+}
+
+void local_to_model(const Skeleton& skeleton, const Pose& pose, float* out_model) {
+  size_t num_joints = skeleton.NumJoints();
+  const int32_t* parents = skeleton.parents.data();
+  const float* translations = pose.translations.data();
+  const float* rotations = pose.rotations.data();
+  const float* scales = pose.scales.data();
+
+  for (size_t j = 0; j < num_joints; j++) {
+    float* model = out_model + j * 16;
+    if (parents[j] < 0) {
+      mat4_from_trs(translations + j * 3, rotations + j * 4, scales + j * 3, model);
+      continue;
+    }
+
+    float local[16];
+    mat4_from_trs(translations + j * 3, rotations + j * 4, scales + j * 3, local);
+    mat4_mul(out_model + (size_t)parents[j] * 16, local, model);
+  }
+}
+
+void local_to_model_batch(const Skeleton& skeleton, const Pose* poses, size_t count, ThreadPool* pool, float* out_model) {
+  size_t stride = skeleton.NumJoints() * 16;
+  auto evaluate = [&](size_t begin, size_t end) {
+    BONES_ZONE("local to model");
+    for (size_t i = begin; i < end; i++) {
+      local_to_model(skeleton, poses[i], out_model + i * stride);
+    }
+  };
+
+  if (pool) {
+    pool->ParallelFor(count, BatchInstances, evaluate);
+  } else {
+    evaluate(0, count);
+  }
+}
+
+void build_joint_palette(const Skeleton& skeleton, const float* model, float* out_palette) {
+  const float* inverse_bind = skeleton.inverse_bind.data();
+  for (size_t j = 0; j < skeleton.NumJoints(); j++) {
+    mat4_mul(model + j * 16, inverse_bind + j * 16, out_palette + j * 16);
+  }
+}
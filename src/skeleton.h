@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "animation.h"
+#include "ufbx.h"
+
+class ThreadPool;
+
+// The scene node hierarchy flattened into joints, one per node, ordered depth
+// first so every parent comes before its children and subtrees are contiguous.
+// Everything is indexed by joint, node_joints maps scene typed ids to joints.
+// Poses and clips of a model are laid out in this joint order.
+class Skeleton {
+public:
+  bool Build(const ufbx_scene* scene);
+
+  // Derives node_joints and rest_model from the stored arrays, false when they
+  // are inconsistent (e.g. a parent after its child in a stale cache).
+  bool Finish();
+
+  size_t NumJoints() const { return parents.size(); }
+
+  std::vector<int32_t> parents;      // -1 for roots, otherwise below the joint's own index
+  std::vector<uint32_t> joint_nodes; // scene typed id of every joint
+  std::vector<uint32_t> node_joints;
+
+  // Rest local TRS, and the rest model-space matrices it composes to.
+  Pose rest;
+  std::vector<float> rest_model;
+
+  // Model-to-joint matrix at bind time, 16 floats per joint. From the skin
+  // clusters for bones, the inverse rest matrix for every other joint.
+  std::vector<float> inverse_bind;
+};
+
+// Composes pose into 16 floats of model-space matrix per joint in a single
+// pass, parents are always done by the time their children are reached.
+void local_to_model(const Skeleton& skeleton, const Pose& pose, float* out_model);
+
+// local_to_model for count instances, pose i lands at out_model + i * NumJoints() * 16.
+// Instances are spread over pool when it is given.
+void local_to_model_batch(const Skeleton& skeleton, const Pose* poses, size_t count, ThreadPool* pool, float* out_model);
+
+// Skinning palette of every joint, model * inverse_bind.
+void build_joint_palette(const Skeleton& skeleton, const float* model, float* out_palette);
@@ -0,0 +1,417 @@
+#include "skinning.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+bool build_skin_data(const ufbx_skin_deformer* skin, size_t num_vertices, const uint32_t* vertex_ids,
+                     const float* positions, const float* normals, size_t stride, int max_influences, SkinData& out) {
+  if (max_influences != 4 && max_influences != 8) {
+    return false;
+  }
+  if (skin->clusters.count == 0 || skin->clusters.count > UINT16_MAX) {
+    return false;
+  }
+
+  size_t num_slots = num_vertices * (size_t)max_influences;
+
+  out.num_vertices = num_vertices;
+  out.max_influences = max_influences;
+  out.bone_indices.assign(num_slots, 0);
+  out.bone_weights.assign(num_slots, 0.0f);
+  out.bind_positions.resize(num_vertices * 3);
+  out.bind_normals.resize(normals ? num_vertices * 3 : 0);
+
+  for (size_t v = 0; v < num_vertices; v++) {
+    for (int i = 0; i < 3; i++) {
+      out.bind_positions[v * 3 + i] = positions[v * stride + i];
+    }
+    if (normals) {
+      for (int i = 0; i < 3; i++) {
+        out.bind_normals[v * 3 + i] = normals[v * stride + i];
+      }
+    }
+
+    uint32_t id = vertex_ids[v];
+    size_t count = 0;
+    const ufbx_skin_weight* weights = nullptr;
+    if (id < skin->vertices.count) {
+      const ufbx_skin_vertex& sv = skin->vertices.data[id];
+      weights = skin->weights.data + sv.weight_begin;
+      count = std::min<size_t>(sv.num_weights, (size_t)max_influences);
+    }
+
+    // ufbx sorts weights by decreasing influence, so truncating keeps the strongest bones.
+    double total = 0.0;
+    for (size_t k = 0; k < count; k++) {
+      total += weights[k].weight;
+    }
+
+    if (total <= 0.0) {
+      out.bone_weights[v] = 1.0f;
+      continue;
+    }
+
+    for (size_t k = 0; k < count; k++) {
+      out.bone_indices[k * num_vertices + v] = (uint16_t)weights[k].cluster_index;
+      out.bone_weights[k * num_vertices + v] = (float)(weights[k].weight / total);
+    }
+  }
+
+  size_t num_bones = skin->clusters.count;
+  out.bone_joints.resize(num_bones);
+  out.geometry_to_bone.resize(num_bones * 16);
+  for (size_t b = 0; b < num_bones; b++) {
+    const ufbx_skin_cluster* cluster = skin->clusters.data[b];
+    out.bone_joints[b] = cluster->bone_node ? cluster->bone_node->typed_id : 0;
+    mat4_from_ufbx(cluster->geometry_to_bone, out.geometry_to_bone.data() + b * 16);
+  }
+
+  std::vector<Aabb> bone_boxes(num_bones);
+  for (size_t v = 0; v < num_vertices; v++) {
+    for (int k = 0; k < max_influences && out.bone_weights[k * num_vertices + v] > 0.0f; k++) {
+      uint16_t bone = out.bone_indices[k * num_vertices + v];
+      const float* p = out.bind_positions.data() + v * 3;
+      const float* m = out.geometry_to_bone.data() + (size_t)bone * 16;
+      float local[3];
+      for (int r = 0; r < 3; r++) {
+        local[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+      }
+      bone_boxes[bone].Add(local);
+    }
+  }
+
+  out.bone_bounds.assign(num_bones * 6, -1.0f);
+  for (size_t b = 0; b < num_bones; b++) {
+    if (!bone_boxes[b].Empty()) {
+      for (int i = 0; i < 3; i++) {
+        out.bone_bounds[b * 6 + i] = (bone_boxes[b].min[i] + bone_boxes[b].max[i]) * 0.5f;
+        out.bone_bounds[b * 6 + 3 + i] = (bone_boxes[b].max[i] - bone_boxes[b].min[i]) * 0.5f;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool build_skin_data(const ufbx_mesh* mesh, const ufbx_skin_deformer* skin, int max_influences, SkinData& out) {
+  size_t num_vertices = mesh->num_vertices;
+  std::vector<uint32_t> vertex_ids(num_vertices);
+  std::vector<float> positions(num_vertices * 3);
+  for (size_t v = 0; v < num_vertices; v++) {
+    vertex_ids[v] = (uint32_t)v;
+    positions[v * 3 + 0] = (float)mesh->vertices.data[v].x;
+    positions[v * 3 + 1] = (float)mesh->vertices.data[v].y;
+    positions[v * 3 + 2] = (float)mesh->vertices.data[v].z;
+  }
+
+  return build_skin_data(skin, num_vertices, vertex_ids.data(), positions.data(), nullptr, 3, max_influences, out);
+}
+
+void build_skin_palette(const SkinData& skin, const float* bone_matrices, float* out_palette) {
+  for (size_t b = 0; b < skin.NumBones(); b++) {
+    mat4_mul(bone_matrices + (size_t)skin.bone_joints[b] * 16, skin.geometry_to_bone.data() + b * 16, out_palette + b * 16);
+  }
+}
+
+void add_skin_bounds(const SkinData& skin, const float* bone_matrices, Aabb& out) {
+  for (size_t b = 0; b < skin.NumBones(); b++) {
+    const float* box = skin.bone_bounds.data() + b * 6;
+    if (box[3] >= 0.0f) {
+      add_transformed_box(bone_matrices + (size_t)skin.bone_joints[b] * 16, box, box + 3, out);
+    }
+  }
+}
+
+void build_dual_quats(const float* palette, size_t num_bones, DualQuat* out) {
+  for (size_t b = 0; b < num_bones; b++) {
+    const float* m = palette + b * 16;
+
+    // Strip scale so the rotation part is orthonormal, DQS cannot represent it anyway.
+    float cols[3][3];
+    for (int c = 0; c < 3; c++) {
+      float len = std::sqrt(m[c * 4] * m[c * 4] + m[c * 4 + 1] * m[c * 4 + 1] + m[c * 4 + 2] * m[c * 4 + 2]);
+      float inv = len > 0.0f ? 1.0f / len : 0.0f;
+      for (int r = 0; r < 3; r++) {
+        cols[c][r] = m[c * 4 + r] * inv;
+      }
+    }
+
+    float q[4];
+    float trace = cols[0][0] + cols[1][1] + cols[2][2];
+    if (trace > 0.0f) {
+      float s = std::sqrt(trace + 1.0f) * 2.0f;
+      q[3] = 0.25f * s;
+      q[0] = (cols[1][2] - cols[2][1]) / s;
+      q[1] = (cols[2][0] - cols[0][2]) / s;
+      q[2] = (cols[0][1] - cols[1][0]) / s;
+    } else if (cols[0][0] > cols[1][1] && cols[0][0] > cols[2][2]) {
+      float s = std::sqrt(1.0f + cols[0][0] - cols[1][1] - cols[2][2]) * 2.0f;
+      q[3] = (cols[1][2] - cols[2][1]) / s;
+      q[0] = 0.25f * s;
+      q[1] = (cols[1][0] + cols[0][1]) / s;
+      q[2] = (cols[2][0] + cols[0][2]) / s;
+    } else if (cols[1][1] > cols[2][2]) {
+      float s = std::sqrt(1.0f + cols[1][1] - cols[0][0] - cols[2][2]) * 2.0f;
+      q[3] = (cols[2][0] - cols[0][2]) / s;
+      q[0] = (cols[1][0] + cols[0][1]) / s;
+      q[1] = 0.25f * s;
+      q[2] = (cols[2][1] + cols[1][2]) / s;
+    } else {
+      float s = std::sqrt(1.0f + cols[2][2] - cols[0][0] - cols[1][1]) * 2.0f;
+      q[3] = (cols[0][1] - cols[1][0]) / s;
+      q[0] = (cols[2][0] + cols[0][2]) / s;
+      q[1] = (cols[2][1] + cols[1][2]) / s;
+      q[2] = 0.25f * s;
+    }
+
+    float t[3] = { m[12], m[13], m[14] };
+    DualQuat& dq = out[b];
+    for (int i = 0; i < 4; i++) {
+      dq.real[i] = q[i];
+    }
+    dq.dual[0] = 0.5f * ( t[0] * q[3] + t[1] * q[2] - t[2] * q[1]);
+    dq.dual[1] = 0.5f * (-t[0] * q[2] + t[1] * q[3] + t[2] * q[0]);
+    dq.dual[2] = 0.5f * ( t[0] * q[1] - t[1] * q[0] + t[2] * q[3]);
+    dq.dual[3] = -0.5f * (t[0] * q[0] + t[1] * q[1] + t[2] * q[2]);
+  }
+}
+
+static inline void store3(float* out, const float* v) {
+  out[0] = v[0];
+  out[1] = v[1];
+  out[2] = v[2];
+}
+
+static inline void normalize3(float* v) {
+  float len2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+  if (len2 > 0.0f) {
+    float inv = 1.0f / std::sqrt(len2);
+    v[0] *= inv;
+    v[1] *= inv;
+    v[2] *= inv;
+  }
+}
+
+static void skin_linear(const SkinData& skin, const float* palette, size_t begin, size_t end,
+                        float* out_positions, float* out_normals) {
+  const size_t n = skin.num_vertices;
+  const int max_influences = skin.max_influences;
+  const uint16_t* indices = skin.bone_indices.data();
+  const float* weights = skin.bone_weights.data();
+  const float* positions = skin.bind_positions.data();
+  const float* normals = out_normals && !skin.bind_normals.empty() ? skin.bind_normals.data() : nullptr;
+
+  for (size_t v = begin; v < end; v++) {
+    const float* p = positions + v * 3;
+    float pos[4];
+    float nrm[4];
+
+#if defined(BONES_AVX2)
+    // Blend two columns per FMA: c01 holds columns 0-1, c23 columns 2-3.
+    __m256 c01 = _mm256_setzero_ps();
+    __m256 c23 = _mm256_setzero_ps();
+    for (int k = 0; k < max_influences; k++) {
+      float w = weights[k * n + v];
+      if (w == 0.0f) break;
+      const float* m = palette + (size_t)indices[k * n + v] * 16;
+      __m256 ws = _mm256_set1_ps(w);
+      c01 = _mm256_fmadd_ps(_mm256_loadu_ps(m), ws, c01);
+      c23 = _mm256_fmadd_ps(_mm256_loadu_ps(m + 8), ws, c23);
+    }
+
+    __m256 xy = _mm256_setr_ps(p[0], p[0], p[0], p[0], p[1], p[1], p[1], p[1]);
+    __m256 z1 = _mm256_setr_ps(p[2], p[2], p[2], p[2], 1.0f, 1.0f, 1.0f, 1.0f);
+    __m256 t = _mm256_fmadd_ps(c01, xy, _mm256_mul_ps(c23, z1));
+    _mm_storeu_ps(pos, _mm_add_ps(_mm256_castps256_ps128(t), _mm256_extractf128_ps(t, 1)));
+
+    if (normals) {
+      const float* nv = normals + v * 3;
+      __m256 nxy = _mm256_setr_ps(nv[0], nv[0], nv[0], nv[0], nv[1], nv[1], nv[1], nv[1]);
+      __m256 nz0 = _mm256_setr_ps(nv[2], nv[2], nv[2], nv[2], 0.0f, 0.0f, 0.0f, 0.0f);
+      __m256 tn = _mm256_fmadd_ps(c01, nxy, _mm256_mul_ps(c23, nz0));
+      _mm_storeu_ps(nrm, _mm_add_ps(_mm256_castps256_ps128(tn), _mm256_extractf128_ps(tn, 1)));
+    }
+#elif defined(BONES_SSE)
+    __m128 c0 = _mm_setzero_ps();
+    __m128 c1 = _mm_setzero_ps();
+    __m128 c2 = _mm_setzero_ps();
+    __m128 c3 = _mm_setzero_ps();
+    for (int k = 0; k < max_influences; k++) {
+      float w = weights[k * n + v];
+      if (w == 0.0f) break;
+      const float* m = palette + (size_t)indices[k * n + v] * 16;
+      __m128 ws = _mm_set1_ps(w);
+      c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(m + 0), ws));
+      c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(m + 4), ws));
+      c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(m + 8), ws));
+      c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(m + 12), ws));
+    }
+
+    __m128 t = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+    t = _mm_add_ps(t, _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+    _mm_storeu_ps(pos, t);
+
+    if (normals) {
+      const float* nv = normals + v * 3;
+      __m128 tn = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(nv[0])), _mm_mul_ps(c1, _mm_set1_ps(nv[1])));
+      tn = _mm_add_ps(tn, _mm_mul_ps(c2, _mm_set1_ps(nv[2])));
+      _mm_storeu_ps(nrm, tn);
+    }
+#else
+    float blend[16] = {};
+    for (int k = 0; k < max_influences; k++) {
+      float w = weights[k * n + v];
+      if (w == 0.0f) break;
+      const float* m = palette + (size_t)indices[k * n + v] * 16;
+      for (int i = 0; i < 16; i++) {
+        blend[i] += m[i] * w;
+      }
+    }
+
+    for (int r = 0; r < 3; r++) {
+      pos[r] = blend[r] * p[0] + blend[4 + r] * p[1] + blend[8 + r] * p[2] + blend[12 + r];
+    }
+
+    if (normals) {
+      const float* nv = normals + v * 3;
+      for (int r = 0; r < 3; r++) {
+        nrm[r] = blend[r] * nv[0] + blend[4 + r] * nv[1] + blend[8 + r] * nv[2];
+      }
+    }
+#endif
+
+    store3(out_positions + v * 3, pos);
+    if (normals) {
+      normalize3(nrm);
+      store3(out_normals + v * 3, nrm);
+    }
+  }
+}
+
+static inline void cross3(const float* a, const float* b, float* out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static void skin_dual_quat(const SkinData& skin, const DualQuat* dual_quats, size_t begin, size_t end,
+                           float* out_positions, float* out_normals) {
+  const size_t n = skin.num_vertices;
+  const int max_influences = skin.max_influences;
+  const uint16_t* indices = skin.bone_indices.data();
+  const float* weights = skin.bone_weights.data();
+  const float* positions = skin.bind_positions.data();
+  const float* normals = out_normals && !skin.bind_normals.empty() ? skin.bind_normals.data() : nullptr;
+
+  for (size_t v = begin; v < end; v++) {
+    const float* pivot = dual_quats[indices[v]].real;
+    alignas(32) float blend[8];
+
+#if defined(BONES_AVX2)
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < max_influences; k++) {
+      float w = weights[k * n + v];
+      if (w == 0.0f) break;
+      const DualQuat& dq = dual_quats[indices[k * n + v]];
+      float d = dq.real[0] * pivot[0] + dq.real[1] * pivot[1] + dq.real[2] * pivot[2] + dq.real[3] * pivot[3];
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(dq.real), _mm256_set1_ps(d < 0.0f ? -w : w), acc);
+    }
+    _mm256_store_ps(blend, acc);
+#elif defined(BONES_SSE)
+    __m128 real = _mm_setzero_ps();
+    __m128 dual = _mm_setzero_ps();
+    for (int k = 0; k < max_influences; k++) {
+      float w = weights[k * n + v];
+      if (w == 0.0f) break;
+      const DualQuat& dq = dual_quats[indices[k * n + v]];
+      float d = dq.real[0] * pivot[0] + dq.real[1] * pivot[1] + dq.real[2] * pivot[2] + dq.real[3] * pivot[3];
+      __m128 ws = _mm_set1_ps(d < 0.0f ? -w : w);
+      real = _mm_add_ps(real, _mm_mul_ps(_mm_loadu_ps(dq.real), ws));
+      dual = _mm_add_ps(dual, _mm_mul_ps(_mm_loadu_ps(dq.dual), ws));
+    }
+    _mm_store_ps(blend, real);
+    _mm_store_ps(blend + 4, dual);
+#else
+    for (int i = 0; i < 8; i++) {
+      blend[i] = 0.0f;
+    }
+    for (int k = 0; k < max_influences; k++) {
+      float w = weights[k * n + v];
+      if (w == 0.0f) break;
+      const DualQuat& dq = dual_quats[indices[k * n + v]];
+      float d = dq.real[0] * pivot[0] + dq.real[1] * pivot[1] + dq.real[2] * pivot[2] + dq.real[3] * pivot[3];
+      if (d < 0.0f) w = -w;
+      for (int i = 0; i < 4; i++) {
+        blend[i] += dq.real[i] * w;
+        blend[4 + i] += dq.dual[i] * w;
+      }
+    }
+#endif
+
+    float len2 = blend[0] * blend[0] + blend[1] * blend[1] + blend[2] * blend[2] + blend[3] * blend[3];
+    float inv = len2 > 0.0f ? 1.0f / std::sqrt(len2) : 0.0f;
+    for (int i = 0; i < 8; i++) {
+      blend[i] *= inv;
+    }
+
+    const float* r = blend;
+    const float* d = blend + 4;
+    const float* p = positions + v * 3;
+
+    // p' = p + 2 r x (r x p + w p) + translation
+    float a[3], b[3], pos[3];
+    cross3(r, p, a);
+    a[0] += r[3] * p[0];
+    a[1] += r[3] * p[1];
+    a[2] += r[3] * p[2];
+    cross3(r, a, b);
+
+    float rd[3];
+    cross3(r, d, rd);
+    for (int i = 0; i < 3; i++) {
+      float translation = 2.0f * (r[3] * d[i] - d[3] * r[i] + rd[i]);
+      pos[i] = p[i] + 2.0f * b[i] + translation;
+    }
+    store3(out_positions + v * 3, pos);
+
+    if (normals) {
+      const float* nv = normals + v * 3;
+      float nrm[3];
+      cross3(r, nv, a);
+      a[0] += r[3] * nv[0];
+      a[1] += r[3] * nv[1];
+      a[2] += r[3] * nv[2];
+      cross3(r, a, b);
+      for (int i = 0; i < 3; i++) {
+        nrm[i] = nv[i] + 2.0f * b[i];
+      }
+      store3(out_normals + v * 3, nrm);
+    }
+  }
+}
+
+void skin_vertices_range(const SkinData& skin, const SkinPose& pose, SkinningMethod method,
+                         size_t begin, size_t end, float* out_positions, float* out_normals) {
+  BONES_ZONE("skin vertices");
+  if (method == SkinningMethod::DualQuaternion) {
+    skin_dual_quat(skin, pose.dual_quats, begin, end, out_positions, out_normals);
+  } else {
+    skin_linear(skin, pose.palette, begin, end, out_positions, out_normals);
+  }
+}
+
+void skin_vertices(const SkinData& skin, const SkinPose& pose, SkinningMethod method,
+                   ThreadPool* pool, float* out_positions, float* out_normals) {
+  if (!pool) {
+    skin_vertices_range(skin, pose, method, 0, skin.num_vertices, out_positions, out_normals);
+    return;
+  }
+
+  pool->ParallelFor(skin.num_vertices, 2048, [&](size_t begin, size_t end) {
+    skin_vertices_range(skin, pose, method, begin, end, out_positions, out_normals);
+  });
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "culling.h"
+#include "ufbx.h"
+
+class ThreadPool;
+
+enum class SkinningMethod {
+  Linear,
+  DualQuaternion,
+};
+
+struct DualQuat {
+  float real[4]; // x, y, z, w
+  float dual[4];
+};
+
+// Per-vertex bone influences packed as SoA streams: influence k of vertex v is
+// at [k * num_vertices + v]. Influences are sorted by decreasing weight and
+// padded with zero weights up to max_influences (4 or 8).
+struct SkinData {
+  size_t num_vertices = 0;
+  int max_influences = 0;
+  std::vector<uint16_t> bone_indices;
+  std::vector<float> bone_weights;
+
+  // Bind pose in mesh space, xyz per vertex. Normals are optional.
+  std::vector<float> bind_positions;
+  std::vector<float> bind_normals;
+
+  // One entry per ufbx_skin_cluster: the bone's row in the matrices
+  // build_skin_palette() reads and the column-major mesh-to-bone bind matrix.
+  // build_skin_data() stores scene typed ids, models remap them to skeleton joints.
+  std::vector<uint32_t> bone_joints;
+  std::vector<float> geometry_to_bone;
+
+  // Bone space box of the bind positions every bone moves, center xyz and half
+  // extents xyz per bone. Bones that move no vertex have negative extents.
+  std::vector<float> bone_bounds;
+
+  size_t NumBones() const { return bone_joints.size(); }
+};
+
+// Per-frame input of one skinned instance. palette holds 16 floats per bone
+// (bone world * geometry_to_bone), dual_quats is only read for DualQuaternion.
+struct SkinPose {
+  const float* palette = nullptr;
+  const DualQuat* dual_quats = nullptr;
+};
+
+// Skin for arbitrary vertices: vertex_ids maps each vertex to its ufbx control point,
+// positions and normals (may be null) are read as xyz with a stride in floats.
+bool build_skin_data(const ufbx_skin_deformer* skin, size_t num_vertices, const uint32_t* vertex_ids,
+                     const float* positions, const float* normals, size_t stride, int max_influences, SkinData& out);
+
+// Skin for the control points of mesh.
+bool build_skin_data(const ufbx_mesh* mesh, const ufbx_skin_deformer* skin, int max_influences, SkinData& out);
+
+// bone_matrices holds 16 floats per joint (or scene node), indexed by bone_joints.
+void build_skin_palette(const SkinData& skin, const float* bone_matrices, float* out_palette);
+
+// Adds the model space box around the skinned vertices to out, from the bone
+// boxes moved by bone_matrices (as for build_skin_palette). A blended vertex
+// lies between its bones' transforms of it, so the boxes stay conservative.
+void add_skin_bounds(const SkinData& skin, const float* bone_matrices, Aabb& out);
+void build_dual_quats(const float* palette, size_t num_bones, DualQuat* out);
+
+// Skins vertices [begin, end) into xyz output arrays, out_normals may be null.
+void skin_vertices_range(const SkinData& skin, const SkinPose& pose, SkinningMethod method,
+                         size_t begin, size_t end, float* out_positions, float* out_normals);
+
+// Skins every vertex, splitting the range over pool when it is given.
+void skin_vertices(const SkinData& skin, const SkinPose& pose, SkinningMethod method,
+                   ThreadPool* pool, float* out_positions, float* out_normals);
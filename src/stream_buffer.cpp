@@ -0,0 +1,142 @@
+#include "stream_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "profiler.h"
+
+namespace {
+
+constexpr GLbitfield PersistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+bool StreamBuffer::Create(size_t size, bool allow_persistent) {
+  GLint alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  uniform_alignment = alignment > 0 ? (size_t)alignment : 256;
+
+  // Regions start on a boundary every target accepts.
+  frame_size = align_up(size, std::max<size_t>(uniform_alignment, 64));
+  stats = StreamStats();
+
+  // Created through the copy target so no rendering binding is disturbed.
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+  if (allow_persistent && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)) {
+    glBufferStorage(GL_COPY_WRITE_BUFFER, frame_size * StreamFrames, nullptr, PersistentFlags);
+    mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frame_size * StreamFrames, PersistentFlags);
+    if (!mapped) {
+      // Immutable storage cannot be respecified, start over with a fresh buffer.
+      glDeleteBuffers(1, &buffer);
+      glGenBuffers(1, &buffer);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    }
+  }
+
+  if (!mapped) {
+    glBufferData(GL_COPY_WRITE_BUFFER, frame_size, nullptr, GL_STREAM_DRAW);
+    staging.resize(frame_size);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  region = 0;
+  used = 0;
+  flushed = 0;
+  return buffer != 0;
+}
+
+void StreamBuffer::Destroy() {
+  for (GLsync& fence : fences) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+
+  if (mapped) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mapped = nullptr;
+  }
+  glDeleteBuffers(1, &buffer);
+  buffer = 0;
+  staging.clear();
+}
+
+void StreamBuffer::BeginFrame() {
+  used = 0;
+  flushed = 0;
+
+  if (!mapped) {
+    // Orphan: the driver hands out fresh storage while last frame's draws keep the old one.
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, frame_size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return;
+  }
+
+  region = (region + 1) % StreamFrames;
+  GLsync& fence = fences[region];
+  if (!fence) {
+    return;
+  }
+
+  GLenum status = glClientWaitSync(fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    auto start = std::chrono::steady_clock::now();
+    do {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    stats.fence_stalls++;
+    stats.stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+  if (status == GL_WAIT_FAILED) {
+    fprintf(stderr, "glClientWaitSync failed on the stream buffer\n");
+  }
+
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+void* StreamBuffer::Allocate(size_t size, size_t alignment, GLintptr& offset) {
+  size_t start = align_up(used, alignment);
+  if (start + size > frame_size) {
+    return nullptr;
+  }
+  used = start + size;
+  stats.bytes_uploaded += size;
+  BONES_COUNT(ProfileCounter::BytesUploaded, size);
+
+  if (mapped) {
+    offset = (GLintptr)(region * frame_size + start);
+    return mapped + offset;
+  }
+  offset = (GLintptr)start;
+  return staging.data() + start;
+}
+
+void StreamBuffer::Flush() {
+  if (mapped || flushed == used) {
+    return;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, flushed, used - flushed, staging.data() + flushed);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  flushed = used;
+}
+
+void StreamBuffer::EndFrame() {
+  Flush();
+  if (mapped) {
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+constexpr int StreamFrames = 3;
+
+struct StreamStats {
+  uint64_t bytes_uploaded = 0;
+  uint64_t fence_stalls = 0; // frames that had to wait for the GPU to release their region
+  double stall_ms = 0.0;
+};
+
+// Ring of StreamFrames regions for data written once per frame (uniform blocks,
+// instances, bone palettes). With GL 4.4 / ARB_buffer_storage the buffer is
+// persistently mapped and callers write straight into GPU-visible memory, each
+// region fenced until the GPU is done with it. On plain GL 3.3 writes go to a
+// staging copy that Flush() uploads with glBufferSubData into an orphaned buffer.
+// One buffer serves every target, bind it with the offsets Allocate() returns.
+class StreamBuffer {
+public:
+  // allow_persistent = false forces the GL 3.3 path, to compare both on one driver.
+  bool Create(size_t frame_size, bool allow_persistent = true);
+  void Destroy();
+
+  // Moves to the next region, waiting on its fence if the GPU still reads it.
+  void BeginFrame();
+
+  // Reserves size bytes in this frame's region, returns null when the region is full.
+  void* Allocate(size_t size, size_t alignment, GLintptr& offset);
+
+  template <typename T>
+  T* Allocate(GLintptr& offset) {
+    return (T*)Allocate(sizeof(T), UniformAlignment(), offset);
+  }
+
+  // Makes everything allocated so far visible to draws, a no-op when persistently mapped.
+  void Flush();
+
+  // Fences the region once this frame's draws are submitted.
+  void EndFrame();
+
+  GLuint Buffer() const { return buffer; }
+  bool Persistent() const { return mapped != nullptr; }
+  size_t FrameSize() const { return frame_size; }
+  size_t TotalSize() const { return Persistent() ? frame_size * StreamFrames : frame_size; }
+  size_t UniformAlignment() const { return uniform_alignment; }
+
+  const StreamStats& Stats() const { return stats; }
+
+private:
+  GLuint buffer = 0;
+  size_t frame_size = 0;
+  size_t uniform_alignment = 256;
+
+  uint8_t* mapped = nullptr;
+  GLsync fences[StreamFrames] = {};
+  int region = 0;
+
+  std::vector<uint8_t> staging;
+  size_t used = 0;
+  size_t flushed = 0;
+
+  StreamStats stats;
+};
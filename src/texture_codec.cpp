@@ -0,0 +1,561 @@
+#include "texture_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr int BlockPixels = 16;
+
+// Fixed BC7 interpolation weights of 4-bit indices, out of 64.
+constexpr int Bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// The 4x4 block at (bx, by) as RGBA8, edges repeated past the level.
+void load_block(const uint8_t* rgba, int width, int height, int bx, int by, uint8_t* block) {
+  for (int y = 0; y < 4; y++) {
+    int sy = std::min(by * 4 + y, height - 1);
+    for (int x = 0; x < 4; x++) {
+      int sx = std::min(bx * 4 + x, width - 1);
+      memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+    }
+  }
+}
+
+void store_block(const uint8_t* block, int width, int height, int bx, int by, uint8_t* rgba) {
+  for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+    for (int x = 0; x < 4 && bx * 4 + x < width; x++) {
+      memcpy(rgba + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4, block + (y * 4 + x) * 4, 4);
+    }
+  }
+}
+
+// Ends of the block's principal axis over the first channels, from the
+// covariance by power iteration.
+void fit_line(const uint8_t* block, int channels, float* lo, float* hi) {
+  float mean[4] = {};
+  for (int i = 0; i < BlockPixels; i++) {
+    for (int c = 0; c < channels; c++) {
+      mean[c] += block[i * 4 + c];
+    }
+  }
+  for (int c = 0; c < channels; c++) {
+    mean[c] /= (float)BlockPixels;
+  }
+
+  float cov[4][4] = {};
+  float min[4] = { 255.0f, 255.0f, 255.0f, 255.0f };
+  float max[4] = {};
+  for (int i = 0; i < BlockPixels; i++) {
+    for (int a = 0; a < channels; a++) {
+      float da = block[i * 4 + a] - mean[a];
+      min[a] = std::min(min[a], (float)block[i * 4 + a]);
+      max[a] = std::max(max[a], (float)block[i * 4 + a]);
+      for (int b = 0; b < channels; b++) {
+        cov[a][b] += da * (block[i * 4 + b] - mean[b]);
+      }
+    }
+  }
+
+  float axis[4];
+  for (int c = 0; c < channels; c++) {
+    axis[c] = max[c] - min[c];
+  }
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[4] = {};
+    float length = 0.0f;
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) {
+        next[a] += cov[a][b] * axis[b];
+      }
+      length = std::max(length, std::fabs(next[a]));
+    }
+    if (length <= 0.0f) {
+      break;
+    }
+    for (int c = 0; c < channels; c++) {
+      axis[c] = next[c] / length;
+    }
+  }
+
+  float length = 0.0f;
+  for (int c = 0; c < channels; c++) {
+    length += axis[c] * axis[c];
+  }
+  if (length <= 0.0f) {
+    memcpy(lo, mean, channels * sizeof(float));
+    memcpy(hi, mean, channels * sizeof(float));
+    return;
+  }
+
+  float t_min = 0.0f;
+  float t_max = 0.0f;
+  for (int i = 0; i < BlockPixels; i++) {
+    float t = 0.0f;
+    for (int c = 0; c < channels; c++) {
+      t += (block[i * 4 + c] - mean[c]) * axis[c];
+    }
+    t_min = std::min(t_min, t);
+    t_max = std::max(t_max, t);
+  }
+  for (int c = 0; c < channels; c++) {
+    lo[c] = std::clamp(mean[c] + axis[c] * t_min / length, 0.0f, 255.0f);
+    hi[c] = std::clamp(mean[c] + axis[c] * t_max / length, 0.0f, 255.0f);
+  }
+}
+
+// Least squares endpoints for fixed indices, weights[i] is how much of end 1 pixel i gets.
+bool refine_line(const uint8_t* block, int channels, const float* weights, float* e0, float* e1) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ap[4] = {}, bp[4] = {};
+  for (int i = 0; i < BlockPixels; i++) {
+    float b = weights[i];
+    float a = 1.0f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < channels; c++) {
+      ap[c] += a * block[i * 4 + c];
+      bp[c] += b * block[i * 4 + c];
+    }
+  }
+
+  float det = aa * bb - ab * ab;
+  if (std::fabs(det) < 1e-6f) {
+    return false;
+  }
+  for (int c = 0; c < channels; c++) {
+    e0[c] = std::clamp((bb * ap[c] - ab * bp[c]) / det, 0.0f, 255.0f);
+    e1[c] = std::clamp((aa * bp[c] - ab * ap[c]) / det, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+int squared_distance(const uint8_t* a, const int* b, int channels) {
+  int sum = 0;
+  for (int c = 0; c < channels; c++) {
+    int d = a[c] - b[c];
+    sum += d * d;
+  }
+  return sum;
+}
+
+// BC1 / BC3 colour
+
+uint16_t pack_565(const float* color) {
+  int r = (int)std::lrint(color[0] * 31.0f / 255.0f);
+  int g = (int)std::lrint(color[1] * 63.0f / 255.0f);
+  int b = (int)std::lrint(color[2] * 31.0f / 255.0f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void unpack_565(uint16_t value, int* out) {
+  int r = value >> 11;
+  int g = (value >> 5) & 63;
+  int b = value & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+// Four colour palette as the decoder builds it for color0 > color1.
+void color_palette(uint16_t color0, uint16_t color1, int palette[4][3]) {
+  unpack_565(color0, palette[0]);
+  unpack_565(color1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+}
+
+int color_indices(const uint8_t* block, uint16_t color0, uint16_t color1, uint8_t* indices) {
+  int palette[4][3];
+  color_palette(color0, color1, palette);
+  int error = 0;
+  for (int i = 0; i < BlockPixels; i++) {
+    int best = 0;
+    int best_distance = squared_distance(block + i * 4, palette[0], 3);
+    for (int p = 1; p < 4; p++) {
+      int distance = squared_distance(block + i * 4, palette[p], 3);
+      if (distance < best_distance) {
+        best = p;
+        best_distance = distance;
+      }
+    }
+    indices[i] = (uint8_t)best;
+    error += best_distance;
+  }
+  return error;
+}
+
+void encode_color_block(const uint8_t* block, uint8_t* out) {
+  float lo[3], hi[3];
+  fit_line(block, 3, lo, hi);
+  uint16_t color0 = pack_565(hi);
+  uint16_t color1 = pack_565(lo);
+  uint8_t indices[BlockPixels];
+  int error = color_indices(block, color0, color1, indices);
+
+  // One least squares pass over the indices the line fit picked.
+  constexpr float EndWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+  float weights[BlockPixels];
+  for (int i = 0; i < BlockPixels; i++) {
+    weights[i] = EndWeights[indices[i]];
+  }
+  if (refine_line(block, 3, weights, hi, lo)) {
+    uint16_t refined0 = pack_565(hi);
+    uint16_t refined1 = pack_565(lo);
+    uint8_t refined[BlockPixels];
+    if (color_indices(block, refined0, refined1, refined) < error) {
+      color0 = refined0;
+      color1 = refined1;
+      memcpy(indices, refined, sizeof(indices));
+    }
+  }
+
+  // color0 > color1 selects the four colour mode, swapping the ends swaps index pairs.
+  if (color0 < color1) {
+    std::swap(color0, color1);
+    for (uint8_t& index : indices) {
+      index ^= 1;
+    }
+  } else if (color0 == color1) {
+    memset(indices, 0, sizeof(indices));
+  }
+
+  uint32_t bits = 0;
+  for (int i = 0; i < BlockPixels; i++) {
+    bits |= (uint32_t)indices[i] << (i * 2);
+  }
+  memcpy(out, &color0, 2);
+  memcpy(out + 2, &color1, 2);
+  memcpy(out + 4, &bits, 4);
+}
+
+void decode_color_block(const uint8_t* in, bool allow_transparent, uint8_t* block) {
+  uint16_t color0, color1;
+  uint32_t bits;
+  memcpy(&color0, in, 2);
+  memcpy(&color1, in + 2, 2);
+  memcpy(&bits, in + 4, 4);
+
+  int palette[4][3];
+  color_palette(color0, color1, palette);
+  int alpha[4] = { 255, 255, 255, 255 };
+  if (color0 <= color1 && allow_transparent) {
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+    alpha[3] = 0;
+  }
+
+  for (int i = 0; i < BlockPixels; i++) {
+    int index = (bits >> (i * 2)) & 3;
+    for (int c = 0; c < 3; c++) {
+      block[i * 4 + c] = (uint8_t)palette[index][c];
+    }
+    block[i * 4 + 3] = (uint8_t)alpha[index];
+  }
+}
+
+// BC3 alpha
+
+void alpha_palette(int alpha0, int alpha1, int* palette) {
+  palette[0] = alpha0;
+  palette[1] = alpha1;
+  if (alpha0 > alpha1) {
+    for (int i = 1; i < 7; i++) {
+      palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+    }
+  } else {
+    for (int i = 1; i < 5; i++) {
+      palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+void encode_alpha_block(const uint8_t* block, uint8_t* out) {
+  int alpha0 = 0;
+  int alpha1 = 255;
+  for (int i = 0; i < BlockPixels; i++) {
+    alpha0 = std::max(alpha0, (int)block[i * 4 + 3]);
+    alpha1 = std::min(alpha1, (int)block[i * 4 + 3]);
+  }
+
+  int palette[8];
+  alpha_palette(alpha0, alpha1, palette);
+  uint64_t bits = 0;
+  for (int i = 0; alpha0 > alpha1 && i < BlockPixels; i++) {
+    int best = 0;
+    for (int p = 1; p < 8; p++) {
+      if (std::abs(palette[p] - block[i * 4 + 3]) < std::abs(palette[best] - block[i * 4 + 3])) {
+        best = p;
+      }
+    }
+    bits |= (uint64_t)best << (i * 3);
+  }
+
+  out[0] = (uint8_t)alpha0;
+  out[1] = (uint8_t)alpha1;
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = (uint8_t)(bits >> (i * 8));
+  }
+}
+
+void decode_alpha_block(const uint8_t* in, uint8_t* block) {
+  int palette[8];
+  alpha_palette(in[0], in[1], palette);
+  uint64_t bits = 0;
+  for (int i = 0; i < 6; i++) {
+    bits |= (uint64_t)in[2 + i] << (i * 8);
+  }
+  for (int i = 0; i < BlockPixels; i++) {
+    block[i * 4 + 3] = (uint8_t)palette[(bits >> (i * 3)) & 7];
+  }
+}
+
+// BC7 mode 6
+
+class BitWriter {
+public:
+  explicit BitWriter(uint8_t* out) : out(out) { memset(out, 0, 16); }
+
+  void Put(uint32_t value, int bits) {
+    for (int i = 0; i < bits; i++, position++) {
+      out[position >> 3] |= (uint8_t)(((value >> i) & 1) << (position & 7));
+    }
+  }
+
+private:
+  uint8_t* out;
+  int position = 0;
+};
+
+class BitReader {
+public:
+  explicit BitReader(const uint8_t* in) : in(in) {}
+
+  uint32_t Get(int bits) {
+    uint32_t value = 0;
+    for (int i = 0; i < bits; i++, position++) {
+      value |= (uint32_t)((in[position >> 3] >> (position & 7)) & 1) << i;
+    }
+    return value;
+  }
+
+private:
+  const uint8_t* in;
+  int position = 0;
+};
+
+// 7 bits per channel plus a shared low bit, the p-bit that fits the endpoint best.
+void quantize_bc7_endpoint(const float* endpoint, uint8_t* out, int* out_pbit) {
+  float best_error = 0.0f;
+  for (int pbit = 0; pbit < 2; pbit++) {
+    uint8_t quantized[4];
+    float error = 0.0f;
+    for (int c = 0; c < 4; c++) {
+      quantized[c] = (uint8_t)std::clamp((int)std::lrint((endpoint[c] - pbit) * 0.5f), 0, 127);
+      float d = (float)(quantized[c] * 2 + pbit) - endpoint[c];
+      error += d * d;
+    }
+    if (pbit == 0 || error < best_error) {
+      best_error = error;
+      memcpy(out, quantized, 4);
+      *out_pbit = pbit;
+    }
+  }
+}
+
+void bc7_palette(const uint8_t* end0, int pbit0, const uint8_t* end1, int pbit1, int palette[16][4]) {
+  for (int c = 0; c < 4; c++) {
+    int e0 = end0[c] * 2 + pbit0;
+    int e1 = end1[c] * 2 + pbit1;
+    for (int i = 0; i < 16; i++) {
+      palette[i][c] = ((64 - Bc7Weights[i]) * e0 + Bc7Weights[i] * e1 + 32) >> 6;
+    }
+  }
+}
+
+int bc7_indices(const uint8_t* block, const int palette[16][4], uint8_t* indices) {
+  int error = 0;
+  for (int i = 0; i < BlockPixels; i++) {
+    int best = 0;
+    int best_distance = squared_distance(block + i * 4, palette[0], 4);
+    for (int p = 1; p < 16; p++) {
+      int distance = squared_distance(block + i * 4, palette[p], 4);
+      if (distance < best_distance) {
+        best = p;
+        best_distance = distance;
+      }
+    }
+    indices[i] = (uint8_t)best;
+    error += best_distance;
+  }
+  return error;
+}
+
+void encode_bc7_block(const uint8_t* block, uint8_t* out) {
+  float lo[4], hi[4];
+  fit_line(block, 4, lo, hi);
+
+  uint8_t end0[4], end1[4];
+  int pbit0, pbit1;
+  quantize_bc7_endpoint(lo, end0, &pbit0);
+  quantize_bc7_endpoint(hi, end1, &pbit1);
+  int palette[16][4];
+  bc7_palette(end0, pbit0, end1, pbit1, palette);
+  uint8_t indices[BlockPixels];
+  int error = bc7_indices(block, palette, indices);
+
+  float weights[BlockPixels];
+  for (int i = 0; i < BlockPixels; i++) {
+    weights[i] = (float)Bc7Weights[indices[i]] / 64.0f;
+  }
+  if (refine_line(block, 4, weights, lo, hi)) {
+    uint8_t refined0[4], refined1[4];
+    int refined_pbit0, refined_pbit1;
+    quantize_bc7_endpoint(lo, refined0, &refined_pbit0);
+    quantize_bc7_endpoint(hi, refined1, &refined_pbit1);
+    bc7_palette(refined0, refined_pbit0, refined1, refined_pbit1, palette);
+    uint8_t refined[BlockPixels];
+    if (bc7_indices(block, palette, refined) < error) {
+      memcpy(end0, refined0, 4);
+      memcpy(end1, refined1, 4);
+      pbit0 = refined_pbit0;
+      pbit1 = refined_pbit1;
+      memcpy(indices, refined, sizeof(indices));
+    }
+  }
+
+  // The first index drops its top bit, so it has to be in the lower half.
+  if (indices[0] & 8) {
+    std::swap(end0, end1);
+    std::swap(pbit0, pbit1);
+    for (uint8_t& index : indices) {
+      index = (uint8_t)(15 - index);
+    }
+  }
+
+  BitWriter writer(out);
+  writer.Put(1 << 6, 7);
+  for (int c = 0; c < 4; c++) {
+    writer.Put(end0[c], 7);
+    writer.Put(end1[c], 7);
+  }
+  writer.Put((uint32_t)pbit0, 1);
+  writer.Put((uint32_t)pbit1, 1);
+  writer.Put(indices[0], 3);
+  for (int i = 1; i < BlockPixels; i++) {
+    writer.Put(indices[i], 4);
+  }
+}
+
+// Anything but mode 6 is not written by this encoder and decodes to black.
+void decode_bc7_block(const uint8_t* in, uint8_t* block) {
+  if ((in[0] & 0x7f) != (1 << 6)) {
+    memset(block, 0, BlockPixels * 4);
+    return;
+  }
+
+  BitReader reader(in);
+  reader.Get(7);
+  uint8_t end0[4], end1[4];
+  for (int c = 0; c < 4; c++) {
+    end0[c] = (uint8_t)reader.Get(7);
+    end1[c] = (uint8_t)reader.Get(7);
+  }
+  int pbit0 = (int)reader.Get(1);
+  int pbit1 = (int)reader.Get(1);
+
+  int palette[16][4];
+  bc7_palette(end0, pbit0, end1, pbit1, palette);
+  for (int i = 0; i < BlockPixels; i++) {
+    uint32_t index = reader.Get(i == 0 ? 3 : 4);
+    for (int c = 0; c < 4; c++) {
+      block[i * 4 + c] = (uint8_t)palette[index][c];
+    }
+  }
+}
+
+} // namespace
+
+const char* texture_format_name(TextureFormat format) {
+  switch (format) {
+    case TextureFormat::Rgba8: return "RGBA8";
+    case TextureFormat::Bc1: return "BC1";
+    case TextureFormat::Bc3: return "BC3";
+    case TextureFormat::Bc7: return "BC7";
+  }
+  return "unknown";
+}
+
+size_t texture_level_size(TextureFormat format, int width, int height) {
+  size_t blocks = (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4);
+  switch (format) {
+    case TextureFormat::Rgba8: return (size_t)width * height * 4;
+    case TextureFormat::Bc1: return blocks * 8;
+    default: return blocks * 16;
+  }
+}
+
+void compress_texture_level(TextureFormat format, const uint8_t* rgba, int width, int height, uint8_t* out) {
+  if (format == TextureFormat::Rgba8) {
+    memcpy(out, rgba, (size_t)width * height * 4);
+    return;
+  }
+
+  uint8_t block[BlockPixels * 4];
+  for (int by = 0; by < (height + 3) / 4; by++) {
+    for (int bx = 0; bx < (width + 3) / 4; bx++) {
+      load_block(rgba, width, height, bx, by, block);
+      switch (format) {
+        case TextureFormat::Bc1:
+          encode_color_block(block, out);
+          out += 8;
+          break;
+        case TextureFormat::Bc3:
+          encode_alpha_block(block, out);
+          encode_color_block(block, out + 8);
+          out += 16;
+          break;
+        default:
+          encode_bc7_block(block, out);
+          out += 16;
+          break;
+      }
+    }
+  }
+}
+
+void decompress_texture_level(TextureFormat format, const uint8_t* blocks, int width, int height, uint8_t* out_rgba) {
+  if (format == TextureFormat::Rgba8) {
+    memcpy(out_rgba, blocks, (size_t)width * height * 4);
+    return;
+  }
+
+  uint8_t block[BlockPixels * 4];
+  for (int by = 0; by < (height + 3) / 4; by++) {
+    for (int bx = 0; bx < (width + 3) / 4; bx++) {
+      switch (format) {
+        case TextureFormat::Bc1:
+          decode_color_block(blocks, true, block);
+          blocks += 8;
+          break;
+        case TextureFormat::Bc3:
+          decode_color_block(blocks + 8, false, block);
+          decode_alpha_block(blocks, block);
+          blocks += 16;
+          break;
+        default:
+          decode_bc7_block(blocks, block);
+          blocks += 16;
+          break;
+      }
+      store_block(block, width, height, bx, by, out_rgba);
+    }
+  }
+}
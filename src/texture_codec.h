@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// GPU block formats the texture cache stores mips in. Every block covers 4x4
+// pixels, levels smaller than a block are padded by repeating their edge.
+enum class TextureFormat : int32_t {
+  Rgba8,
+  Bc1, // 8 bytes per block, opaque RGB
+  Bc3, // 16 bytes per block, BC1 colour plus interpolated alpha
+  Bc7, // 16 bytes per block, mode 6 only: one RGBA line with 16 steps
+};
+
+const char* texture_format_name(TextureFormat format);
+
+// Bytes of a width x height level in format.
+size_t texture_level_size(TextureFormat format, int width, int height);
+
+// Encodes an RGBA8 level into blocks of format, out holds texture_level_size() bytes.
+void compress_texture_level(TextureFormat format, const uint8_t* rgba, int width, int height, uint8_t* out);
+
+// Decodes a level back to RGBA8, for drivers without the format and for measuring error.
+void decompress_texture_level(TextureFormat format, const uint8_t* blocks, int width, int height, uint8_t* out_rgba);
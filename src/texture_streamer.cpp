@@ -0,0 +1,255 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+constexpr size_t PageSize = 4096;
+
+// Reads a byte of every page so the mapped level is in memory before the GL thread needs it.
+void page_in(const uint8_t* data, size_t size) {
+  volatile uint8_t sink = 0;
+  for (size_t offset = 0; offset < size; offset += PageSize) {
+    sink = sink + data[offset];
+  }
+  if (size > 0) {
+    sink = sink + data[size - 1];
+  }
+}
+
+// What a level takes on the GPU, formats the driver lacks are decoded to RGBA8.
+size_t gpu_level_size(const TextureAsset& asset, int level) {
+  if (texture_format_supported(asset.format)) {
+    return asset.LevelSize(level);
+  }
+  return texture_level_size(TextureFormat::Rgba8, asset.LevelWidth(level), asset.LevelHeight(level));
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+TextureStreamer::TextureStreamer(ThreadPool& pool) : pool(pool) {}
+
+TextureStreamer::~TextureStreamer() {
+  // Tasks still hold their entries, wait for them before those go away.
+  while (loading.load(std::memory_order_acquire) > 0) {
+    if (!pool.RunPendingTask()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool TextureStreamer::Create(size_t budget_bytes, size_t upload_bytes_per_update) {
+  budget = budget_bytes;
+  upload_bytes = upload_bytes_per_update;
+
+  const uint8_t pixel[4] = {255, 255, 255, 255};
+  TextureAsset placeholder;
+  placeholder.width = 1;
+  placeholder.height = 1;
+  placeholder.num_mips = 1;
+  placeholder.mips[0] = pixel;
+  glGenTextures(1, &white);
+  upload_texture(white, placeholder);
+  return white != 0;
+}
+
+void TextureStreamer::Destroy() {
+  while (loading.load(std::memory_order_acquire) > 0) {
+    if (!pool.RunPendingTask()) {
+      std::this_thread::yield();
+    }
+  }
+
+  for (const std::unique_ptr<Entry>& entry : entries) {
+    glDeleteTextures(1, &entry->texture);
+  }
+  glDeleteTextures(1, &white);
+  white = 0;
+  entries.clear();
+  candidates.clear();
+  stats = TextureStreamStats();
+}
+
+uint32_t TextureStreamer::Request(const char* path) {
+  entries.push_back(std::make_unique<Entry>());
+  candidates.reserve(entries.size()); // so Update() never grows it
+  Entry* entry = entries.back().get();
+  entry->path = path;
+  entry->requested = Clock::now();
+  entry->last_used = frame;
+  stats.textures++;
+
+  loading.fetch_add(1, std::memory_order_relaxed);
+  pool.Submit([this, entry] {
+    BONES_ZONE("texture page-in");
+    if (!load_texture(entry->path.c_str(), entry->asset, false)) {
+      entry->paged_levels.store(-1, std::memory_order_release);
+    } else {
+      const TextureAsset& asset = entry->asset;
+      for (int level = asset.num_mips - 1; level >= 0; level--) {
+        page_in(asset.mips[level], asset.LevelSize(level));
+        entry->paged_levels.store(asset.num_mips - level, std::memory_order_release);
+      }
+    }
+    loading.fetch_sub(1, std::memory_order_release);
+  });
+  return (uint32_t)(entries.size() - 1);
+}
+
+GLuint TextureStreamer::Use(uint32_t handle) {
+  if (handle >= entries.size()) {
+    return white;
+  }
+  Entry& entry = *entries[handle];
+  entry.last_used = frame;
+  return entry.resident_levels > 0 ? entry.texture : white;
+}
+
+bool TextureStreamer::Idle() const {
+  return loading.load(std::memory_order_acquire) == 0 && !uploads_pending;
+}
+
+void TextureStreamer::Update() {
+  BONES_ZONE("texture update");
+  Clock::time_point start = Clock::now();
+
+  decode_scratch.Reset();
+  candidates.clear();
+  for (const std::unique_ptr<Entry>& entry : entries) {
+    int paged = entry->paged_levels.load(std::memory_order_acquire);
+    if (paged < 0 && !entry->failed) {
+      fprintf(stderr, "Failed to stream texture %s\n", entry->path.c_str());
+      entry->failed = true;
+      stats.failed_textures++;
+    }
+    if (entry->resident_levels < paged) {
+      candidates.push_back(entry.get());
+    }
+  }
+
+  // Coarsest first across textures: those with the fewest levels go first, the
+  // most recently used of them before the rest.
+  std::sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) {
+    if (a->resident_levels != b->resident_levels) {
+      return a->resident_levels < b->resident_levels;
+    }
+    return a->last_used > b->last_used;
+  });
+
+  // One level per texture per pass, so a large chain never holds up the tails of the others.
+  size_t uploaded = 0;
+  uint64_t evicted_levels = stats.evicted_levels;
+  uploads_pending = false;
+  bool progress = true;
+  while (progress && !uploads_pending) {
+    progress = false;
+    for (Entry* entry : candidates) {
+      bool evicted = stats.evicted_levels != evicted_levels;
+      if (entry->resident_levels >= entry->paged_levels.load(std::memory_order_acquire)) {
+        continue;
+      }
+
+      size_t size = gpu_level_size(entry->asset, entry->asset.num_mips - entry->resident_levels - 1);
+      if (uploaded > 0 && uploaded + size > upload_bytes) {
+        uploads_pending = true;
+        break;
+      }
+      // Only textures drawn since the last update take levels from others, the rest
+      // fill what is free, and not after an eviction or the two would trade levels.
+      bool wanted = entry->last_used == frame;
+      if (wanted ? !MakeRoom(size, entry->last_used, entry)
+                 : evicted || stats.resident_bytes + size > budget) {
+        continue;
+      }
+
+      UploadLevel(*entry);
+      uploaded += size;
+      progress = true;
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  stats.resident_textures = 0;
+  stats.complete_textures = 0;
+  for (const std::unique_ptr<Entry>& entry : entries) {
+    stats.resident_textures += entry->resident_levels > 0;
+    stats.complete_textures += entry->resident_levels > 0 && entry->resident_levels == entry->asset.num_mips;
+  }
+
+  frame++;
+  stats.update_ms += elapsed_ms(start);
+}
+
+void TextureStreamer::UploadLevel(Entry& entry) {
+  const TextureAsset& asset = entry.asset;
+  if (!entry.texture) {
+    glGenTextures(1, &entry.texture);
+    glBindTexture(GL_TEXTURE_2D, entry.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, asset.num_mips > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, asset.num_mips - 1);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, entry.texture);
+  }
+
+  // Sampling starts at the finest resident level, the rest of the chain is below it.
+  int level = asset.num_mips - entry.resident_levels - 1;
+  size_t size = upload_texture_level(asset, level, &decode_scratch);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+
+  entry.level_bytes[level] = size;
+  entry.resident_levels++;
+  stats.resident_bytes += size;
+  stats.peak_resident_bytes = std::max(stats.peak_resident_bytes, stats.resident_bytes);
+  stats.uploaded_bytes += size;
+
+  if (entry.resident_levels == 1) {
+    stats.first_level_ms = std::max(stats.first_level_ms, elapsed_ms(entry.requested));
+  }
+  if (entry.resident_levels == asset.num_mips) {
+    stats.complete_ms = std::max(stats.complete_ms, elapsed_ms(entry.requested));
+  }
+}
+
+void TextureStreamer::EvictLevel(Entry& entry) {
+  int level = entry.asset.num_mips - entry.resident_levels;
+  glBindTexture(GL_TEXTURE_2D, entry.texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+
+  // Redefining the level as empty is what lets the driver free its storage.
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+  stats.resident_bytes -= entry.level_bytes[level];
+  stats.evicted_bytes += entry.level_bytes[level];
+  stats.evicted_levels++;
+  entry.level_bytes[level] = 0;
+  entry.resident_levels--;
+}
+
+bool TextureStreamer::MakeRoom(size_t size, uint64_t last_used, const Entry* keep) {
+  while (stats.resident_bytes + size > budget) {
+    Entry* victim = nullptr;
+    for (const std::unique_ptr<Entry>& entry : entries) {
+      if (entry.get() != keep && entry->resident_levels > 1 && entry->last_used < last_used &&
+          (!victim || entry->last_used < victim->last_used)) {
+        victim = entry.get();
+      }
+    }
+    if (!victim) {
+      return false;
+    }
+    EvictLevel(*victim);
+  }
+  return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "allocators.h"
+#include "asset.h"
+
+class ThreadPool;
+
+constexpr size_t DefaultTextureBudget = (size_t)256 << 20;
+constexpr size_t DefaultTextureUploadBytes = (size_t)4 << 20;
+
+struct TextureStreamStats {
+  size_t textures = 0;
+  size_t resident_textures = 0; // at least the coarsest level on the GPU
+  size_t complete_textures = 0; // every level on the GPU
+  size_t failed_textures = 0;
+  size_t resident_bytes = 0;
+  size_t peak_resident_bytes = 0;
+  uint64_t uploaded_bytes = 0;
+  uint64_t evicted_bytes = 0;
+  uint64_t evicted_levels = 0;
+  double first_level_ms = 0.0; // slowest request to its first resident level
+  double complete_ms = 0.0;    // slowest request to all of its levels, of those that got there
+  double update_ms = 0.0;      // total CPU time spent in Update()
+};
+
+// Keeps texture mip chains on the GPU within a memory budget. The pool maps each
+// texture's cache and pages its levels in coarsest first, Update() uploads what
+// has arrived and, when the budget runs out, takes the finest levels away from
+// the least recently used textures. A texture draws as white until its first level
+// lands and never loses its coarsest one.
+class TextureStreamer {
+public:
+  explicit TextureStreamer(ThreadPool& pool);
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  // upload_bytes_per_update caps what one Update() uploads, so a burst of arrivals spreads over frames.
+  bool Create(size_t budget_bytes = DefaultTextureBudget, size_t upload_bytes_per_update = DefaultTextureUploadBytes);
+  void Destroy();
+
+  // Starts streaming path, every call gets its own copy so callers dedupe paths.
+  uint32_t Request(const char* path);
+
+  // Marks the texture used this frame and returns the name to bind.
+  GLuint Use(uint32_t handle);
+
+  // Once per frame on the GL thread, leaves GL_TEXTURE_2D unbound.
+  void Update();
+
+  // True once everything requested is resident as far as the budget allows.
+  bool Idle() const;
+
+  size_t Budget() const { return budget; }
+  const TextureStreamStats& Stats() const { return stats; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    std::string path;
+    TextureAsset asset;              // written by the worker before paged_levels first moves
+    std::atomic<int> paged_levels{0}; // coarsest levels paged in, -1 when loading failed
+    Clock::time_point requested;
+
+    GLuint texture = 0;
+    int resident_levels = 0; // levels [num_mips - resident_levels, num_mips) are on the GPU
+    size_t level_bytes[MaxTextureMips] = {};
+    uint64_t last_used = 0;
+    bool failed = false;
+  };
+
+  void UploadLevel(Entry& entry);
+  void EvictLevel(Entry& entry);
+
+  // Evicts levels of textures used before last_used until size more bytes fit.
+  bool MakeRoom(size_t size, uint64_t last_used, const Entry* keep);
+
+  ThreadPool& pool;
+  std::vector<std::unique_ptr<Entry>> entries;
+  std::vector<Entry*> candidates;
+  FrameArena decode_scratch; // levels the driver cannot sample, decoded by this Update()
+  std::atomic<size_t> loading{0};
+
+  GLuint white = 0;
+  size_t budget = 0;
+  size_t upload_bytes = 0;
+  uint64_t frame = 1;
+  bool uploads_pending = false;
+  TextureStreamStats stats;
+};
@@ -0,0 +1,211 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "profiler.h"
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  workers.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; i++) {
+    workers.emplace_back([this, i] {
+      char name[32];
+      snprintf(name, sizeof(name), "worker %zu", i);
+      profiler_set_thread_name(name);
+      WorkerLoop();
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  if (workers.empty()) {
+    task();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  wake.notify_one();
+}
+
+bool ThreadPool::RunPendingTask() {
+  std::function<void()> task;
+  Range* range = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (helper_count > 0) {
+      range = PopHelper();
+    } else if (!tasks.empty()) {
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    } else {
+      return false;
+    }
+  }
+
+  if (task) {
+    task();
+  } else if (range) {
+    RunHelper(range);
+  }
+  return true;
+}
+
+void ThreadPool::WorkerLoop() {
+  for (;;) {
+    std::function<void()> task;
+    Range* range = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || helper_count > 0 || !tasks.empty(); });
+      if (helper_count > 0) {
+        range = PopHelper();
+      } else if (!tasks.empty()) {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      } else {
+        return;
+      }
+    }
+
+    if (task) {
+      task();
+    } else if (range) {
+      RunHelper(range);
+    }
+  }
+}
+
+ThreadPool::Range* ThreadPool::PopHelper() {
+  Range* range = helpers[helper_head];
+  helper_head = (helper_head + 1) % MaxHelpers;
+  helper_count--;
+  if (range) {
+    range->running++;
+  }
+  return range;
+}
+
+void ThreadPool::RunHelper(Range* range) {
+  DrainRange(*range);
+
+  bool last;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    last = --range->running == 0;
+  }
+  if (last) {
+    std::lock_guard<std::mutex> lock(range->mutex);
+    range->done.notify_all();
+  }
+}
+
+void ThreadPool::DrainRange(Range& range) {
+  for (;;) {
+    size_t index = range.next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= range.num_batches) {
+      return;
+    }
+
+    size_t begin = index * range.batch;
+    size_t end = std::min(begin + range.batch, range.count);
+    if (begin < end) {
+      range.fn(range.context, begin, end);
+    }
+
+    if (range.finished.fetch_add(1, std::memory_order_acq_rel) + 1 == range.num_batches) {
+      std::lock_guard<std::mutex> lock(range.mutex);
+      range.done.notify_all();
+    }
+  }
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t min_batch, RangeFn fn, const void* context) {
+  if (count == 0) {
+    return;
+  }
+
+  min_batch = std::max<size_t>(min_batch, 1);
+  size_t num_batches = std::min((count + min_batch - 1) / min_batch, Size() * 4);
+  if (num_batches <= 1 || workers.empty()) {
+    fn(context, 0, count);
+    return;
+  }
+
+  Range* range = nullptr;
+  size_t num_helpers = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Range& slot : ranges) {
+      if (!slot.in_use) {
+        range = &slot;
+        break;
+      }
+    }
+    if (range) {
+      range->in_use = true;
+      range->next.store(0, std::memory_order_relaxed);
+      range->finished.store(0, std::memory_order_relaxed);
+      range->count = count;
+      range->batch = (count + num_batches - 1) / num_batches;
+      range->num_batches = num_batches;
+      range->fn = fn;
+      range->context = context;
+
+      num_helpers = std::min({ workers.size(), num_batches - 1, MaxHelpers - helper_count });
+      for (size_t i = 0; i < num_helpers; i++) {
+        helpers[(helper_head + helper_count) % MaxHelpers] = range;
+        helper_count++;
+      }
+    }
+  }
+  if (!range) {
+    fn(context, 0, count);
+    return;
+  }
+  for (size_t i = 0; i < num_helpers; i++) {
+    wake.notify_one();
+  }
+
+  DrainRange(*range);
+
+  // Every batch is claimed, helpers still queued have nothing left to do.
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < helper_count; i++) {
+      Range*& helper = helpers[(helper_head + i) % MaxHelpers];
+      if (helper == range) {
+        helper = nullptr;
+      }
+    }
+  }
+
+  // running is only written under the pool's mutex, helpers notify once they drop it.
+  std::unique_lock<std::mutex> range_lock(range->mutex);
+  range->done.wait(range_lock, [&] {
+    std::lock_guard<std::mutex> lock(mutex);
+    return range->finished.load(std::memory_order_acquire) == num_batches && range->running == 0;
+  });
+  range_lock.unlock();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  range->in_use = false;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  // num_threads counts the calling thread too, 0 picks one per hardware thread.
+  explicit ThreadPool(size_t num_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t Size() const { return workers.size() + 1; }
+
+  // Splits [0, count) into batches of at least min_batch items and runs
+  // fn(begin, end) on the workers and the calling thread. Blocks until done.
+  // fn is only referenced and ranges and helpers use slots preallocated in the
+  // pool, so a call never allocates. With every slot taken it runs inline.
+  template <typename Fn>
+  void ParallelFor(size_t count, size_t min_batch, const Fn& fn) {
+    ParallelFor(count, min_batch, [](const void* context, size_t begin, size_t end) { (*(const Fn*)context)(begin, end); }, &fn);
+  }
+
+  using RangeFn = void (*)(const void* context, size_t begin, size_t end);
+  void ParallelFor(size_t count, size_t min_batch, RangeFn fn, const void* context);
+
+  // Queues a task for the workers, runs it inline when the pool has none.
+  void Submit(std::function<void()> task);
+
+  // Runs one queued task on the calling thread, used to help out while waiting.
+  bool RunPendingTask();
+
+private:
+  static constexpr size_t MaxRanges = 8;   // ParallelFor calls in flight at once
+  static constexpr size_t MaxHelpers = 64; // queued helpers across all of them
+
+  struct Range {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> finished{0};
+    size_t count = 0;
+    size_t batch = 0;
+    size_t num_batches = 0;
+    RangeFn fn = nullptr;
+    const void* context = nullptr;
+    bool in_use = false;  // guarded by the pool's mutex, like running
+    size_t running = 0;   // helpers taken off the queue that may still touch it
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+
+  void WorkerLoop();
+  Range* PopHelper(); // with mutex held, null when the range finished without it
+  void RunHelper(Range* range);
+  static void DrainRange(Range& range);
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  // Helpers are a ring of ranges to drain, served before tasks. A slot is
+  // cleared when its range finishes first.
+  Range ranges[MaxRanges];
+  Range* helpers[MaxHelpers] = {};
+  size_t helper_head = 0;
+  size_t helper_count = 0;
+};